@@ -45,9 +45,9 @@
 #include "gfx.h"
 #include "utils.h"
 #include "biquad.h"
+#include "savestate.h"
+#include "timers.h"
 
-#define TND_LUT_SIZE 203
-#define PULSE_LUT_SIZE 31
 #define AUDIO_TO_FILE 0
 
 
@@ -58,7 +58,7 @@ static const uint8_t length_counter_lookup[32] = {
     /* 1 */ 12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
 };
 
-static uint8_t duty[4][8] =
+static const uint8_t duty[4][8] =
 {
     {0, 1, 0, 0, 0, 0, 0, 0}, // 12.5 %
     {0, 1, 1, 0, 0, 0, 0, 0}, // 25 %
@@ -66,16 +66,16 @@ static uint8_t duty[4][8] =
     {1, 0, 0, 1, 1, 1, 1, 1} // 25 % negated
 };
 
-static uint8_t tri_sequence[32] = {
+static const uint8_t tri_sequence[32] = {
     15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
     0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
 };
 
-static uint16_t noise_period_lookup_NTSC[16] = {
+static const uint16_t noise_period_lookup_NTSC[16] = {
     4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
 };
 
-static uint16_t noise_period_lookup_PAL[16] = {
+static const uint16_t noise_period_lookup_PAL[16] = {
     4, 8, 14, 30, 60, 88, 118, 148, 188, 236, 354, 472, 708, 944, 1890, 3778
 };
 
@@ -86,11 +86,11 @@ NTSC  428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106,  84,  72,
 PAL   398, 354, 316, 298, 276, 236, 210, 198, 176, 148, 132, 118,  98,  78,  66,  50
 */
 
-static uint16_t dmc_rate_index_NTSC[16] = {
+static const uint16_t dmc_rate_index_NTSC[16] = {
     428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106,  84,  72,  54
 };
 
-static uint16_t dmc_rate_index_PAL[16] = {
+static const uint16_t dmc_rate_index_PAL[16] = {
     398, 354, 316, 298, 276, 236, 210, 198, 176, 148, 132, 118,  98,  78,  66,  50
 };
 
@@ -124,10 +124,7 @@ Step 5      Clock           Clock           -           37281   41565
  */
 
 
-static float tnd_LUT[TND_LUT_SIZE];
-static float pulse_LUT[PULSE_LUT_SIZE];
-
-static void compute_mixer_LUT();
+static void compute_mixer_LUT(APU* apu);
 
 static void init_audio_device(const APU* apu);
 
@@ -151,7 +148,9 @@ static uint8_t clock_divider_inverse(Divider *divider);
 
 static void update_target_period(Pulse* pulse);
 
-static void clock_dmc(APU* apu);
+static void dmc_fetch(APU* apu);
+
+static void dmc_output(APU* apu);
 
 static void quarter_frame(APU *apu);
 
@@ -159,12 +158,38 @@ static void half_frame(APU *apu);
 
 static void sample(APU* apu);
 
-FILE *out_wav;
+static void update_pulse_level(APU* apu, Pulse* pulse);
+
+static void update_triangle_level(APU* apu);
+
+static void update_noise_level(APU* apu);
+
+static void update_dmc_level(APU* apu);
+
+static void clock_noise_shift(Noise* noise);
+
+static size_t skip_divider(Divider* divider, size_t clocks, uint8_t advance_step);
+
+static uint8_t pulse_silent(const Pulse* pulse);
+
+static uint8_t noise_silent(const Noise* noise);
+
+static uint8_t triangle_static(const Triangle* triangle);
+
+static void skip_dmc(APU* apu, size_t cycles);
+
+static size_t idle_cycles(const APU* apu);
+
+static void skip_idle_cycles(APU* apu, size_t cycles);
+
+static void serialize_divider(Divider* divider, StateStream* stream);
+
+static void serialize_pulse(Pulse* pulse, StateStream* stream);
 
 void init_APU(struct Emulator *emulator) {
     memset(&emulator->apu, 0, sizeof(APU));
-    compute_mixer_LUT();
     APU *apu = &emulator->apu;
+    compute_mixer_LUT(apu);
     apu->volume = 1;
     apu->emulator = emulator;
     apu->cycles = 0;
@@ -184,12 +209,17 @@ void init_APU(struct Emulator *emulator) {
     init_noise(&apu->noise);
     init_dmc(&apu->dmc);
     init_sampler(apu, SAMPLING_FREQUENCY);
-    init_audio_device(apu);
-    SDL_PauseAudioDevice(emulator->g_ctx.audio_device, 1);
+    if(!emulator->settings.headless) {
+        init_audio_device(apu);
+        SDL_PauseAudioDevice(emulator->g_ctx.audio_device, 1);
+    }
     set_status(apu, 0);
     set_frame_counter_ctrl(apu, 0);
+    // power up with the slowest DMC rate
+    set_dmc_ctrl(apu, 0);
+    apu->mix_dirty = 1;
 #if AUDIO_TO_FILE
-    out_wav = fopen("test-aud.raw", "wb");
+    apu->out_wav = fopen("test-aud.raw", "wb");
 #endif
 }
 
@@ -198,6 +228,7 @@ void reset_APU(APU *apu) {
     apu->triangle.sequencer.step = 0;
     apu->dmc.counter &= 1;
     apu->frame_interrupt = 0;
+    update_channel_levels(apu);
 }
 
 void init_audio_device(const APU* apu) {
@@ -219,9 +250,10 @@ void init_audio_device(const APU* apu) {
     }
 }
 
-void exit_APU() {
-    if (out_wav)
-        fclose(out_wav);
+void exit_APU(APU* apu) {
+    if (apu->out_wav)
+        fclose(apu->out_wav);
+    apu->out_wav = NULL;
 }
 
 void execute_apu(APU *apu) {
@@ -335,30 +367,168 @@ post_sequencer:
 
     if (apu->cycles & 1) {
         // channel sequencer
-        clock_divider(&apu->pulse1.t);
-        clock_divider(&apu->pulse2.t);
+        if (clock_divider(&apu->pulse1.t))
+            update_pulse_level(apu, &apu->pulse1);
+        if (clock_divider(&apu->pulse2.t))
+            update_pulse_level(apu, &apu->pulse2);
 
         // noise timer
         if (clock_divider(&apu->noise.timer)) {
-            Noise *noise = &apu->noise;
-            uint8_t feedback = (noise->shift & BIT_0) ^ (((noise->mode ? BIT_6 : BIT_1) & noise->shift) > 0);
-            noise->shift >>= 1;
-            noise->shift |= feedback ? (1 << 14) : 0;
+            clock_noise_shift(&apu->noise);
+            update_noise_level(apu);
         }
     }
 
     // DMC
-    clock_dmc(apu);
+    if (apu->cycles >= apu->dmc.next_fetch)
+        dmc_fetch(apu);
+    if (apu->cycles >= apu->dmc.next_output)
+        dmc_output(apu);
 
     // triangle timer
-    clock_triangle(&apu->triangle);
+    if (clock_triangle(&apu->triangle))
+        update_triangle_level(apu);
 
     // sample
-    sample(apu);
+    if (!apu->no_audio)
+        sample(apu);
 
     apu->cycles++;
 }
 
+void run_apu_cycles(APU* apu, size_t cycles) {
+    while (cycles > 0) {
+        size_t idle = MIN(idle_cycles(apu), cycles);
+        if (idle > 0) {
+            skip_idle_cycles(apu, idle);
+            cycles -= idle;
+        } else {
+            execute_apu(apu);
+            cycles--;
+        }
+    }
+}
+
+static void clock_noise_shift(Noise* noise) {
+    uint8_t feedback = (noise->shift & BIT_0) ^ (((noise->mode ? BIT_6 : BIT_1) & noise->shift) > 0);
+    noise->shift >>= 1;
+    noise->shift |= feedback ? (1 << 14) : 0;
+}
+
+static size_t skip_divider(Divider* divider, size_t clocks, uint8_t advance_step) {
+    // same as clocking the divider `clocks` times, returns how many times it fired
+    if (clocks <= (size_t)divider->counter) {
+        divider->counter -= clocks;
+        return 0;
+    }
+    size_t rest = clocks - divider->counter - 1, len = divider->period + 1;
+    size_t fired = 1 + rest / len;
+    divider->counter = divider->period - rest % len;
+    if (!advance_step)
+        return fired;
+    if (divider->limit)
+        divider->step = divider->from + (divider->step - divider->from + fired) % (divider->limit - divider->from + 1);
+    else
+        divider->step += fired;
+    return fired;
+}
+
+static uint8_t pulse_silent(const Pulse* pulse) {
+    // output stays at 0 whatever the sequencer does
+    return !pulse->enabled || !pulse->l || pulse->mute
+        || (pulse->const_volume ? pulse->envelope.period : pulse->envelope.step) == 0;
+}
+
+static uint8_t noise_silent(const Noise* noise) {
+    return !noise->enabled || !noise->l || (noise->const_volume ? noise->envelope.period : noise->envelope.step) == 0;
+}
+
+static uint8_t triangle_static(const Triangle* triangle) {
+    // either the sequencer is halted or the output is forced to 0
+    return !triangle->length_counter || !triangle->linear_counter
+        || !triangle->enabled || triangle->sequencer.period <= 1;
+}
+
+static void skip_dmc(APU* apu, size_t cycles) {
+    // only called while the output unit is silent with nothing to fetch,
+    // in which case clocking it just counts down the bits of the empty shift register
+    DMC* dmc = &apu->dmc;
+    size_t end = apu->cycles + cycles;
+    if (dmc->next_output >= end)
+        return;
+    size_t len = dmc->rate + 1;
+    size_t fired = 1 + (end - 1 - dmc->next_output) / len;
+    dmc->next_output += fired * len;
+    if (dmc->bits_remaining == 0) {
+        dmc->bits_remaining = 8;
+        fired--;
+    }
+    dmc->bits_remaining = (dmc->bits_remaining - 1 + 8 - fired % 8) % 8 + 1;
+}
+
+static size_t idle_cycles(const APU* apu) {
+    // number of upcoming cycles in which no unit fires in a way that changes the mixer input
+#if AVERAGE_DOWNSAMPLING
+    // the running average lives in sample(), always go through it
+    return 0;
+#else
+    static const size_t NTSC_steps[] = {7457, 14913, 22371, 29829, 37281};
+    static const size_t PAL_steps[] = {8313, 16627, 24939, 33253, 41565};
+    const size_t* steps = apu->emulator->type == PAL ? PAL_steps : NTSC_steps;
+    const DMC* dmc = &apu->dmc;
+
+    if (apu->reset_sequencer || dmc->next_fetch <= apu->cycles)
+        return 0;
+    if (apu->sampler.counter + 1 >= apu->sampler.period)
+        return 0;
+
+    size_t idle = 0;
+    for (size_t i = 0; i < 5; i++) {
+        if (steps[i] >= apu->sequencer) {
+            idle = steps[i] - apu->sequencer;
+            break;
+        }
+    }
+    idle = MIN(idle, apu->sampler.period - apu->sampler.counter - 1);
+    if (dmc->next_fetch != DMC_NO_EVENT)
+        idle = MIN(idle, dmc->next_fetch - apu->cycles);
+    if (!dmc->silence || !dmc->empty)
+        idle = MIN(idle, dmc->next_output - apu->cycles);
+    // pulse and noise timers are clocked on odd cycles only
+    size_t even = !(apu->cycles & 1);
+    if (!pulse_silent(&apu->pulse1))
+        idle = MIN(idle, 2 * apu->pulse1.t.counter + even);
+    if (!pulse_silent(&apu->pulse2))
+        idle = MIN(idle, 2 * apu->pulse2.t.counter + even);
+    if (!noise_silent(&apu->noise))
+        idle = MIN(idle, 2 * apu->noise.timer.counter + even);
+    if (!triangle_static(&apu->triangle))
+        idle = MIN(idle, apu->triangle.sequencer.counter);
+    return idle;
+#endif
+}
+
+static void skip_idle_cycles(APU* apu, size_t cycles) {
+    // silent channels keep running, their timers are advanced arithmetically
+    Triangle* triangle = &apu->triangle;
+    size_t odd = (cycles + (apu->cycles & 1)) / 2;
+    skip_divider(&apu->pulse1.t, odd, 1);
+    skip_divider(&apu->pulse2.t, odd, 1);
+    size_t noise_clocks = skip_divider(&apu->noise.timer, odd, 1);
+    while (noise_clocks--)
+        clock_noise_shift(&apu->noise);
+    skip_divider(&triangle->sequencer, cycles, triangle->length_counter && triangle->linear_counter);
+
+    if (apu->dmc.silence && apu->dmc.empty)
+        skip_dmc(apu, cycles);
+
+    apu->sequencer += cycles;
+    apu->sampler.counter += cycles;
+    apu->cycles += cycles;
+    // the anti-aliasing filter still has to see every cycle
+    biquad_hold(get_sample(apu), &apu->aa_filter, cycles);
+}
+
 void quarter_frame(APU *apu) {
     Triangle *triangle = &apu->triangle;
     //envelope
@@ -373,6 +543,10 @@ void quarter_frame(APU *apu) {
         triangle->linear_counter--;
     // if halt is clear, clear linear reload flag
     triangle->linear_reload_flag = triangle->halt ? triangle->linear_reload_flag : 0;
+
+    update_pulse_level(apu, &apu->pulse1);
+    update_pulse_level(apu, &apu->pulse2);
+    update_noise_level(apu);
 }
 
 void half_frame(APU *apu) {
@@ -387,6 +561,10 @@ void half_frame(APU *apu) {
     Noise *noise = &apu->noise;
     if (noise->l && !noise->envelope.loop)
         noise->l--;
+
+    update_pulse_level(apu, &apu->pulse1);
+    update_pulse_level(apu, &apu->pulse2);
+    update_noise_level(apu);
 }
 
 void init_sampler(APU* apu, int frequency) {
@@ -405,6 +583,7 @@ void init_sampler(APU* apu, int frequency) {
     sampler->max_index = AUDIO_BUFF_SIZE;
     sampler->samples = 0;
     sampler->counter = 0;
+    sampler->avg = -1;
     sampler->factor_index = 0;
     // basically the precision with which we vary the sampling rate
     // 100 ->2 d.p, 1000->3 d.p, etc.
@@ -415,24 +594,54 @@ void init_sampler(APU* apu, int frequency) {
 }
 
 
+void lock_sample_rate(APU* apu, double clock_rate) {
+    // without an audio device there is no queue to steer the sampler against,
+    // so alternate between the two periods at a fixed ratio that averages out
+    // to exactly SAMPLING_FREQUENCY for the given CPU clock
+    Sampler* sampler = &apu->sampler;
+    double period = clock_rate / SAMPLING_FREQUENCY;
+    sampler->min_period = (size_t)period;
+    sampler->max_period = sampler->min_period + 1;
+    sampler->max_factor = 1000;
+    size_t long_periods = (size_t)((period - sampler->min_period) * (sampler->max_factor + 1) + 0.5);
+    if(long_periods == 0) {
+        sampler->max_period = sampler->min_period;
+        long_periods = 1;
+    }
+    sampler->target_factor = sampler->equilibrium_factor = long_periods - 1;
+    sampler->factor_index = 0;
+    apu->locked_rate = 1;
+}
+
+
+uint64_t wait_for_audio(APU* apu, struct GraphicsContext* ctx) {
+    // the device drains the queue at exactly SAMPLING_FREQUENCY so holding
+    // it at the nominal size runs emulation on the audio clock. Nothing is
+    // played before the queue first fills, don't wait until then
+    uint64_t start = time_ns();
+    while(apu->audio_start && SDL_GetQueuedAudioSize(ctx->audio_device) > NOMINAL_QUEUE_SIZE)
+        wait(1);
+    return time_ns() - start;
+}
+
+
 void sample(APU* apu) {
     float sample = biquad(get_sample(apu), &apu->aa_filter);
+    Sampler* sampler = &apu->sampler;
 #if AVERAGE_DOWNSAMPLING
-    static float avg = -1;
     // average samples in a bin
-    if(avg < 0)
-        avg = sample;
+    if(sampler->avg < 0)
+        sampler->avg = sample;
     else
-        avg = (avg + sample)/2;
+        sampler->avg = (sampler->avg + sample)/2;
 #endif
 
-    Sampler* sampler = &apu->sampler;
     sampler->counter++;
     if(sampler->counter >= sampler->period) {
 #if AVERAGE_DOWNSAMPLING
-        apu->buff[sampler->index++] = 32767 * biquad(avg, &apu->filter);
+        apu->buff[sampler->index++] = 32767 * biquad(sampler->avg, &apu->filter);
         // begin fresh average for the next bin
-        avg = -1;
+        sampler->avg = -1;
 #else
 
         apu->buff[sampler->index++] = 32000 * biquad(sample, &apu->filter) * apu->volume;
@@ -457,6 +666,8 @@ void sample(APU* apu) {
 
 void queue_audio(APU *apu, struct GraphicsContext *ctx) {
     uint32_t queue_size = SDL_GetQueuedAudioSize(ctx->audio_device);
+    if(apu->audio_start && !queue_size)
+        TIMELINE_INSTANT("audio underrun");
     apu->stat = apu->stat - apu->stat_window[apu->stat_index] + queue_size;
     apu->stat_window[apu->stat_index++] = queue_size;
     if(apu->stat_index >= STATS_WIN_SIZE)
@@ -465,21 +676,23 @@ void queue_audio(APU *apu, struct GraphicsContext *ctx) {
     size_t avg = apu->stat / STATS_WIN_SIZE;
     // printf("queue size %d, avg: %llu \n", queue_size, avg);
 
-    // From here we tweak the sampling rate ever so slightly to prevent underruns and runaway latency
-    // by minimising deviation from the nominal queue size with a bit of control engineering
-    float delta_f, error = (float)avg - NOMINAL_QUEUE_SIZE;
     Sampler* s = &apu->sampler;
-    if(error >= 0) {
-        delta_f = (s->max_factor - s->equilibrium_factor) * error / NOMINAL_QUEUE_SIZE;
-    }else {
-        delta_f = (s->equilibrium_factor * error / NOMINAL_QUEUE_SIZE);
-    }
-    // printf("delta %f, error %f \n", delta_f, error);
-    s->target_factor = s->equilibrium_factor + delta_f;
-    if(s->target_factor > s->max_factor) {
-        s->target_factor = s->max_factor;
+    if(!apu->locked_rate) {
+        // From here we tweak the sampling rate ever so slightly to prevent underruns and runaway latency
+        // by minimising deviation from the nominal queue size with a bit of control engineering
+        float delta_f, error = (float)avg - NOMINAL_QUEUE_SIZE;
+        if(error >= 0) {
+            delta_f = (s->max_factor - s->equilibrium_factor) * error / NOMINAL_QUEUE_SIZE;
+        }else {
+            delta_f = (s->equilibrium_factor * error / NOMINAL_QUEUE_SIZE);
+        }
+        // printf("delta %f, error %f \n", delta_f, error);
+        s->target_factor = s->equilibrium_factor + delta_f;
+        if(s->target_factor > s->max_factor) {
+            s->target_factor = s->max_factor;
+        }
+        // printf("target_f %d \n", s->target_factor);
     }
-    // printf("target_f %d \n", s->target_factor);
 
     SDL_QueueAudio(ctx->audio_device, apu->buff, s->index * 2);
     // wait till queue is filled to prevent early onset underruns
@@ -488,8 +701,8 @@ void queue_audio(APU *apu, struct GraphicsContext *ctx) {
         apu->audio_start = 1;
     }
 #if AUDIO_TO_FILE
-    if(out_wav)
-        fwrite(apu->buff, 2, s->index, out_wav);
+    if(apu->out_wav)
+        fwrite(apu->buff, 2, s->index, apu->out_wav);
 #endif
     memset(apu->buff, 0, AUDIO_BUFF_SIZE * 2);
     // reset sampler
@@ -498,28 +711,176 @@ void queue_audio(APU *apu, struct GraphicsContext *ctx) {
 
 
 float get_sample(APU *apu) {
-    uint8_t pulse_out = 0, tnd_out = 0;
+    // only go through the mixer tables when a channel level has changed
+    if (apu->mix_dirty) {
+        float amp = apu->pulse_LUT[apu->pulse_out] + apu->tnd_LUT[apu->tnd_out];
+        // clamp to within 1 just in case
+        apu->mix = amp > 1 ? 1 : amp;
+        apu->mix_dirty = 0;
+    }
+    return apu->mix;
+}
+
+
+static void update_pulse_level(APU* apu, Pulse* pulse) {
+    uint8_t* level = pulse->id == 1 ? &apu->levels.pulse1 : &apu->levels.pulse2;
+    uint8_t out = 0;
+    if (pulse->enabled && pulse->l && !pulse->mute)
+        out = (pulse->const_volume ? pulse->envelope.period : pulse->envelope.step) * duty[pulse->duty][pulse->t.step];
+    if (out == *level)
+        return;
+    apu->pulse_out += out - *level;
+    *level = out;
+    apu->mix_dirty = 1;
+}
+
+static void update_triangle_level(APU* apu) {
+    Triangle* triangle = &apu->triangle;
+    uint8_t out = 0;
+    if (triangle->enabled && triangle->sequencer.period > 1)
+        out = tri_sequence[triangle->sequencer.step];
+    if (out == apu->levels.triangle)
+        return;
+    apu->tnd_out += 3 * (out - apu->levels.triangle);
+    apu->levels.triangle = out;
+    apu->mix_dirty = 1;
+}
+
+static void update_noise_level(APU* apu) {
+    Noise* noise = &apu->noise;
+    uint8_t out = 0;
+    if (noise->enabled && !(noise->shift & BIT_0) && noise->l > 0)
+        out = noise->const_volume ? noise->envelope.period : noise->envelope.step;
+    if (out == apu->levels.noise)
+        return;
+    apu->tnd_out += 2 * (out - apu->levels.noise);
+    apu->levels.noise = out;
+    apu->mix_dirty = 1;
+}
+
+static void update_dmc_level(APU* apu) {
+    uint8_t out = apu->dmc.counter;
+    if (out == apu->levels.dmc)
+        return;
+    apu->tnd_out += out - apu->levels.dmc;
+    apu->levels.dmc = out;
+    apu->mix_dirty = 1;
+}
+
+void update_channel_levels(APU* apu) {
+    update_pulse_level(apu, &apu->pulse1);
+    update_pulse_level(apu, &apu->pulse2);
+    update_triangle_level(apu);
+    update_noise_level(apu);
+    update_dmc_level(apu);
+}
 
-    if (apu->pulse1.enabled && apu->pulse1.l && !apu->pulse1.mute)
-        pulse_out += (apu->pulse1.const_volume ? apu->pulse1.envelope.period : apu->pulse1.envelope.step) * (duty[apu->
-            pulse1.duty][apu->pulse1.t.step]);
 
-    if (apu->pulse2.enabled && apu->pulse2.l && !apu->pulse2.mute)
-        pulse_out += (apu->pulse2.const_volume ? apu->pulse2.envelope.period : apu->pulse2.envelope.step) * (duty[apu->
-            pulse2.duty][apu->pulse2.t.step]);
+static void serialize_divider(Divider* divider, StateStream* stream) {
+    state_long(stream, &divider->period);
+    state_long(stream, &divider->counter);
+    state_u32(stream, &divider->step);
+    state_u32(stream, &divider->limit);
+    state_u32(stream, &divider->from);
+    state_u8(stream, &divider->loop);
+}
 
-    if (apu->triangle.enabled && apu->triangle.sequencer.period > 1)
-        tnd_out += tri_sequence[apu->triangle.sequencer.step] * 3;
 
-    if (apu->noise.enabled && !(apu->noise.shift & BIT_0) && apu->noise.l > 0)
-        tnd_out += 2 * (apu->noise.const_volume ? apu->noise.envelope.period : apu->noise.envelope.step);
+static void serialize_pulse(Pulse* pulse, StateStream* stream) {
+    // the duty table is indexed by duty and sequencer step
+    Divider t = pulse->t;
+    uint8_t duty = pulse->duty;
+    serialize_divider(&t, stream);
+    state_u8(stream, &pulse->l);
+    state_u8(stream, &pulse->neg);
+    state_u8(stream, &pulse->shift);
+    serialize_divider(&pulse->sweep, stream);
+    state_u8(stream, &pulse->enable_sweep);
+    state_u8(stream, &duty);
+    state_u8(stream, &pulse->const_volume);
+    serialize_divider(&pulse->envelope, stream);
+    state_u8(stream, &pulse->envelope_loop);
+    state_u8(stream, &pulse->enabled);
+    state_u8(stream, &pulse->mute);
+    state_u16(stream, &pulse->target_period);
+    state_u8(stream, &pulse->sweep_reload);
+    if(!stream->loading || stream->error)
+        return;
+    if(duty > 3 || t.step > 7) {
+        stream->error = 1;
+        return;
+    }
+    pulse->t = t;
+    pulse->duty = duty;
+}
+
 
-    tnd_out += apu->dmc.counter;
+void serialize_apu(APU* apu, StateStream* stream) {
+    // only the emulated hardware is saved, the sampler, filters and
+    // audio buffer belong to the host audio stream and keep running
+    serialize_pulse(&apu->pulse1, stream);
+    serialize_pulse(&apu->pulse2, stream);
 
-    float amp = pulse_LUT[pulse_out] + tnd_LUT[tnd_out];
+    Triangle* triangle = &apu->triangle;
+    Divider sequencer = triangle->sequencer;
+    serialize_divider(&sequencer, stream);
+    state_u8(stream, &triangle->length_counter);
+    state_u8(stream, &triangle->linear_reload);
+    state_u8(stream, &triangle->linear_counter);
+    state_u8(stream, &triangle->linear_reload_flag);
+    state_u8(stream, &triangle->halt);
+    state_u8(stream, &triangle->enabled);
 
-    // clamp to within 1 just in case
-    return amp > 1 ? 1 : amp;
+    Noise* noise = &apu->noise;
+    serialize_divider(&noise->timer, stream);
+    state_u8(stream, &noise->mode);
+    state_u8(stream, &noise->l);
+    state_u16(stream, &noise->shift);
+    state_u8(stream, &noise->const_volume);
+    serialize_divider(&noise->envelope, stream);
+    state_u8(stream, &noise->envelope_loop);
+    state_u8(stream, &noise->enabled);
+
+    DMC* dmc = &apu->dmc;
+    state_u8(stream, &dmc->enabled);
+    state_u8(stream, &dmc->IRQ_enable);
+    state_u8(stream, &dmc->loop);
+    state_u8(stream, &dmc->counter);
+    state_u16(stream, &dmc->sample_length);
+    state_u16(stream, &dmc->sample_addr);
+    state_u8(stream, &dmc->interrupt);
+    state_u8(stream, &dmc->irq_set);
+    state_u16(stream, &dmc->rate);
+    state_size(stream, &dmc->next_output);
+    state_size(stream, &dmc->next_fetch);
+    state_u8(stream, &dmc->bits_remaining);
+    state_u8(stream, &dmc->silence);
+    state_u8(stream, &dmc->bits);
+    state_u8(stream, &dmc->sample);
+    state_u8(stream, &dmc->empty);
+    state_u16(stream, &dmc->bytes_remaining);
+    state_u16(stream, &dmc->current_addr);
+
+    state_u8(stream, &apu->frame_mode);
+    state_u8(stream, &apu->status);
+    state_u8(stream, &apu->IRQ_inhibit);
+    state_u8(stream, &apu->frame_interrupt);
+    state_u8(stream, &apu->reset_sequencer);
+    state_size(stream, &apu->cycles);
+    state_size(stream, &apu->sequencer);
+
+    if(!stream->loading || stream->error)
+        return;
+    if(sequencer.step > 31) {
+        stream->error = 1;
+        return;
+    }
+    triangle->sequencer = sequencer;
+    // rebuild the mixer inputs from scratch
+    memset(&apu->levels, 0, sizeof(ChannelLevels));
+    apu->pulse_out = apu->tnd_out = 0;
+    update_channel_levels(apu);
+    apu->mix_dirty = 1;
 }
 
 
@@ -534,6 +895,8 @@ void set_status(APU *apu, uint8_t value) {
         // restart it
         apu->dmc.bytes_remaining = apu->dmc.sample_length;
         apu->dmc.current_addr = apu->dmc.sample_addr;
+        if(apu->dmc.empty)
+            apu->dmc.next_fetch = apu->cycles;
     }else if(!apu->dmc.enabled) {
         apu->dmc.bytes_remaining = 0;
     }
@@ -545,6 +908,7 @@ void set_status(APU *apu, uint8_t value) {
     apu->pulse2.l = apu->pulse2.enabled ? apu->pulse2.l : 0;
     apu->triangle.length_counter = apu->triangle.enabled ? apu->triangle.length_counter : 0;
     apu->noise.l = apu->noise.enabled ? apu->noise.l : 0;
+    update_channel_levels(apu);
 }
 
 
@@ -667,38 +1031,39 @@ void set_dmc_length(DMC* dmc, uint8_t value) {
     dmc->sample_length = (uint16_t)value * 16 + 1;
 }
 
-void clock_dmc(APU* apu) {
+static void dmc_fetch(APU* apu) {
     DMC* dmc = &apu->dmc;
+    dmc->next_fetch = DMC_NO_EVENT;
+    if(!dmc->enabled || !dmc->empty || dmc->bytes_remaining == 0)
+        return;
 
-    if(dmc->enabled && dmc->empty) {
-        if(dmc->bytes_remaining > 0) {
-            apu->emulator->cpu.dma_cycles += 3;
-            dmc->sample = read_mem(&apu->emulator->mem, dmc->current_addr);
-            dmc->empty = 0;
-            dmc->bytes_remaining--;
-            if(dmc->current_addr == 0xffff)
-                dmc->current_addr = 0x8000;
-            else
-                dmc->current_addr++;
-            dmc->irq_set = 0;
-        }
-        if(dmc->bytes_remaining == 0) {
-            if(dmc->loop) {
-                dmc->current_addr = dmc->sample_addr;
-                dmc->bytes_remaining = dmc->sample_length;
-            }else if(dmc->IRQ_enable && !dmc->irq_set) {
-                dmc->interrupt = 1;
-                dmc->irq_set = 1;
-                interrupt(&apu->emulator->cpu, IRQ);
-            }
+    Emulator* emulator = apu->emulator;
+    emulator->cpu.dma_cycles += dmc_dma_stall(&emulator->cpu);
+    // sample addresses are always in $8000-$FFFF so go straight to the PRG banks
+    dmc->sample = emulator->mem.bus = emulator->mapper.read_PRG(&emulator->mapper, dmc->current_addr);
+    dmc->empty = 0;
+    dmc->bytes_remaining--;
+    if(dmc->current_addr == 0xffff)
+        dmc->current_addr = 0x8000;
+    else
+        dmc->current_addr++;
+    dmc->irq_set = 0;
+
+    if(dmc->bytes_remaining == 0) {
+        if(dmc->loop) {
+            dmc->current_addr = dmc->sample_addr;
+            dmc->bytes_remaining = dmc->sample_length;
+        }else if(dmc->IRQ_enable && !dmc->irq_set) {
+            dmc->interrupt = 1;
+            dmc->irq_set = 1;
+            interrupt(&emulator->cpu, IRQ);
         }
     }
+}
 
-    if(dmc->rate_index > 0) {
-        dmc->rate_index--;
-        return;
-    }
-    dmc->rate_index = dmc->rate;
+static void dmc_output(APU* apu) {
+    DMC* dmc = &apu->dmc;
+    dmc->next_output = apu->cycles + dmc->rate + 1;
 
     if(dmc->bits_remaining > 0) {
         // clamped counter update
@@ -710,6 +1075,7 @@ void clock_dmc(APU* apu) {
             else if(dmc->counter > 1)
                 dmc->counter-=2;
             dmc->bits >>= 1;
+            update_dmc_level(apu);
         }
         dmc->bits_remaining--;
     }
@@ -720,18 +1086,21 @@ void clock_dmc(APU* apu) {
             dmc->bits = dmc->sample;
             dmc->empty = 1;
             dmc->silence = 0;
+            // refill the buffer on the next cycle
+            if(dmc->enabled && dmc->bytes_remaining > 0)
+                dmc->next_fetch = apu->cycles + 1;
         }
         dmc->bits_remaining = 8;
     }
 }
 
-static void compute_mixer_LUT() {
-    pulse_LUT[0] = 0;
+static void compute_mixer_LUT(APU* apu) {
+    apu->pulse_LUT[0] = 0;
     for (int i = 1; i < PULSE_LUT_SIZE; i++)
-        pulse_LUT[i] = 95.52f / (8128.0f / (float) i + 100);
-    tnd_LUT[0] = 0;
+        apu->pulse_LUT[i] = 95.52f / (8128.0f / (float) i + 100);
+    apu->tnd_LUT[0] = 0;
     for (int i = 1; i < TND_LUT_SIZE; i++)
-        tnd_LUT[i] = 163.67f / (24329.0f / (float) i + 100);
+        apu->tnd_LUT[i] = 163.67f / (24329.0f / (float) i + 100);
 }
 
 static void init_pulse(Pulse *pulse, uint8_t id) {
@@ -763,6 +1132,8 @@ static void init_noise(Noise *noise) {
 static void init_dmc(DMC* dmc) {
     dmc->empty = 1;
     dmc->silence = 1;
+    dmc->next_output = 0;
+    dmc->next_fetch = DMC_NO_EVENT;
 }
 
 static uint8_t clock_divider(Divider *divider) {
@@ -43,11 +43,14 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "biquad.h"
 
 #define SAMPLING_FREQUENCY 48000
+#define NTSC_CPU_CLOCK 1789773.0
+#define PAL_CPU_CLOCK 1662607.0
 // should be able to store samples produced in 1/60th of a second
 // for the target sampling frequency
 // higher sampling frequency will need a bigger buffer
@@ -55,9 +58,14 @@
 #define STATS_WIN_SIZE 20
 #define AVERAGE_DOWNSAMPLING 0
 #define NOMINAL_QUEUE_SIZE 6000
+#define TND_LUT_SIZE 203
+#define PULSE_LUT_SIZE 31
+// DMC event slot with nothing scheduled
+#define DMC_NO_EVENT SIZE_MAX
 
 struct Emulator;
 struct GraphicsContext;
+struct StateStream;
 
 enum {
     TIMER_HIGH = 0x7,
@@ -125,7 +133,9 @@ typedef struct {
     uint8_t interrupt;
     uint8_t irq_set;
     uint16_t rate;
-    uint16_t rate_index;
+    // APU cycles at which the output unit clocks and the next sample byte is fetched
+    size_t next_output;
+    size_t next_fetch;
     // output unit
     uint8_t bits_remaining;
     uint8_t silence;
@@ -149,9 +159,21 @@ typedef struct {
     size_t counter;
     size_t index;
     size_t max_index;
+    // running average of the current bin with AVERAGE_DOWNSAMPLING
+    float avg;
 } Sampler;
 
 
+// current output level of each channel as seen by the mixer
+typedef struct {
+    uint8_t pulse1;
+    uint8_t pulse2;
+    uint8_t triangle;
+    uint8_t noise;
+    uint8_t dmc;
+} ChannelLevels;
+
+
 typedef struct APU{
     struct Emulator* emulator;
     int16_t buff[AUDIO_BUFF_SIZE];
@@ -175,16 +197,36 @@ typedef struct APU{
     Biquad filter;
     Biquad aa_filter;
     float volume;
+    ChannelLevels levels;
+    // mixer inputs kept up to date as channel levels change
+    uint8_t pulse_out;
+    uint8_t tnd_out;
+    uint8_t mix_dirty;
+    float mix;
+    // channels run but no samples are produced
+    uint8_t no_audio;
+    // set by lock_sample_rate, queue_audio leaves the sampling rate alone
+    uint8_t locked_rate;
+    float pulse_LUT[PULSE_LUT_SIZE];
+    float tnd_LUT[TND_LUT_SIZE];
+    // raw sample dump with AUDIO_TO_FILE
+    FILE* out_wav;
 } APU;
 
 
 void init_APU(struct Emulator* emulator);
 void reset_APU(APU *apu);
-void exit_APU();
+void exit_APU(APU* apu);
 void execute_apu(APU* apu);
+void run_apu_cycles(APU* apu, size_t cycles);
 void set_status(APU* apu, uint8_t value);
 float get_sample(APU* apu);
+void update_channel_levels(APU* apu);
+void serialize_apu(APU* apu, struct StateStream* stream);
 void queue_audio(APU* apu, struct GraphicsContext* ctx);
+void lock_sample_rate(APU* apu, double clock_rate);
+// blocks while more than the nominal queue is buffered, returns the ns waited
+uint64_t wait_for_audio(APU* apu, struct GraphicsContext* ctx);
 uint8_t read_apu_status(APU* apu);
 void set_frame_counter_ctrl(APU* apu, uint8_t value);
 
@@ -0,0 +1,343 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <SDL2/SDL.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "emulator.h"
+#include "timers.h"
+#include "utils.h"
+
+#define DEFAULT_BATCH_FRAMES 600
+#define MAX_LINE 1024
+
+typedef struct BatchJob {
+    const char* path;
+    // input movie played from the first frame, optional
+    const char* movie;
+    uint32_t frames;
+    uint8_t done;
+    // rolling hash of every frame, then of CPU RAM and PRG-RAM at the end
+    uint64_t frame_hash;
+    uint64_t ram_hash;
+    double ms;
+} BatchJob;
+
+typedef struct BatchQueue {
+    BatchJob* jobs;
+    size_t len;
+    size_t cap;
+    SDL_atomic_t next;
+} BatchQueue;
+
+typedef struct BatchWorker {
+    SDL_Thread* thread;
+    BatchQueue* queue;
+    Emulator emulator;
+} BatchWorker;
+
+
+static void run_job(BatchWorker* worker, BatchJob* job) {
+    Emulator* emulator = &worker->emulator;
+    memset(emulator, 0, sizeof(Emulator));
+    emulator->settings.headless = true;
+
+    // a bad ROM fails its job and leaves the rest of the batch running
+    if(load_file((char*)job->path, NULL, NULL, &emulator->mapper) < 0) {
+        LOG(ERROR, "Could not load %s, skipping", job->path);
+        return;
+    }
+    if(emulator->mapper.is_nsf) {
+        LOG(ERROR, "%s is an NSF file, skipping", job->path);
+        free_mapper(&emulator->mapper);
+        return;
+    }
+    init_emulator_core(emulator);
+    if(job->movie != NULL) {
+        if(start_playback(&emulator->movie, job->movie, &emulator->mapper) < 0) {
+            LOG(ERROR, "%s: skipping", job->path);
+            free_emulator(emulator);
+            return;
+        }
+        if(!job->frames)
+            job->frames = emulator->movie.length;
+    }
+
+    Timer timer;
+    init_timer(&timer, 0);
+    mark_start(&timer);
+    uint64_t hash = FNV_OFFSET;
+    for(uint32_t i = 0; i < job->frames; i++) {
+        uint32_t* screen = step_frame(emulator);
+        hash = hash_bytes(screen, VISIBLE_DOTS * VISIBLE_SCANLINES * sizeof(uint32_t), hash);
+    }
+    mark_end(&timer);
+    job->ms = get_diff_ms(&timer);
+    release_timer(&timer);
+
+    job->frame_hash = hash;
+    hash = hash_bytes(emulator->mem.RAM, RAM_SIZE, FNV_OFFSET);
+    if(emulator->mapper.PRG_RAM != NULL)
+        hash = hash_bytes(emulator->mapper.PRG_RAM, emulator->mapper.RAM_size, hash);
+    job->ram_hash = hash;
+    job->done = 1;
+
+    free_emulator(emulator);
+}
+
+static int batch_worker(void* data) {
+    BatchWorker* worker = data;
+    BatchQueue* queue = worker->queue;
+    int index;
+    while((index = SDL_AtomicAdd(&queue->next, 1)) < (int)queue->len) {
+        run_job(worker, &queue->jobs[index]);
+    }
+    return 0;
+}
+
+static uint8_t has_extension(const char* file_name, const char* extension) {
+    const char* ext = strrchr(file_name, '.');
+    if(ext == NULL)
+        return 0;
+    for(; *ext && *extension; ext++, extension++) {
+        if(tolower((unsigned char)*ext) != *extension)
+            return 0;
+    }
+    return *ext == *extension;
+}
+
+static char* copy_string(const char* str) {
+    char* owned = malloc(strlen(str) + 1);
+    strcpy(owned, str);
+    return owned;
+}
+
+static void add_job(BatchQueue* queue, const char* path, const char* movie, uint32_t frames) {
+    if(queue->len >= queue->cap) {
+        queue->cap = queue->cap ? queue->cap * 2 : 64;
+        queue->jobs = realloc(queue->jobs, queue->cap * sizeof(BatchJob));
+    }
+    BatchJob* job = &queue->jobs[queue->len++];
+    memset(job, 0, sizeof(BatchJob));
+    job->path = copy_string(path);
+    job->movie = movie != NULL ? copy_string(movie) : NULL;
+    job->frames = frames;
+}
+
+static char* last_field(char* line) {
+    // the space or tab before the last field
+    char* last = strrchr(line, ' ');
+    char* tab = strrchr(line, '\t');
+    return tab > last ? tab : last;
+}
+
+static void end_field(char* line, char* separator) {
+    while(separator > line && isspace((unsigned char)*separator))
+        *separator-- = '\0';
+}
+
+static uint8_t read_list(BatchQueue* queue, const char* list_path, uint32_t frames) {
+    // one ROM per line with an optional .nmv movie and frame count after it,
+    // a movie without a frame count runs for its length,
+    // blank lines and lines starting with # are ignored
+    FILE* list = fopen(list_path, "r");
+    if(list == NULL) {
+        LOG(ERROR, "Could not open %s", list_path);
+        return 0;
+    }
+    char line[MAX_LINE];
+    while(fgets(line, sizeof(line), list) != NULL) {
+        size_t len = strlen(line);
+        while(len > 0 && isspace((unsigned char)line[len - 1]))
+            line[--len] = '\0';
+        char* path = line;
+        while(isspace((unsigned char)*path))
+            path++;
+        if(*path == '\0' || *path == '#')
+            continue;
+
+        uint32_t job_frames = 0;
+        char* last = last_field(path);
+        if(last != NULL) {
+            char* end;
+            unsigned long count = strtoul(last + 1, &end, 10);
+            if(*end == '\0' && end != last + 1 && count > 0) {
+                job_frames = count;
+                end_field(path, last);
+            }
+        }
+        char* movie = NULL;
+        last = last_field(path);
+        if(last != NULL && has_extension(last + 1, ".nmv")) {
+            movie = last + 1;
+            end_field(path, last);
+        }
+        if(movie == NULL && !job_frames)
+            job_frames = frames;
+
+        // missing ROMs fail in the report with the rest
+        add_job(queue, path, movie, job_frames);
+    }
+    fclose(list);
+    return 1;
+}
+
+static void write_json_string(FILE* out, const char* str) {
+    fputc('"', out);
+    for(; *str; str++) {
+        if(*str == '"' || *str == '\\')
+            fputc('\\', out);
+        fputc(*str, out);
+    }
+    fputc('"', out);
+}
+
+static void write_report(FILE* out, const BatchQueue* queue, uint8_t json, double wall_ms) {
+    if(json)
+        fprintf(out, "{\n  \"wall_ms\": %.1f,\n  \"jobs\": [\n", wall_ms);
+    else
+        fprintf(out, "rom,frames,status,frame_hash,ram_hash,ms,fps\n");
+
+    for(size_t i = 0; i < queue->len; i++) {
+        const BatchJob* job = &queue->jobs[i];
+        double fps = job->ms > 0 ? job->frames * 1000.0 / job->ms : 0;
+        const char* status = job->done ? "ok" : "failed";
+        if(json) {
+            fprintf(out, "    {\"rom\": ");
+            write_json_string(out, job->path);
+            fprintf(out, ", \"frames\": %u, \"status\": \"%s\", \"frame_hash\": \"%016llx\", "
+                "\"ram_hash\": \"%016llx\", \"ms\": %.3f, \"fps\": %.1f}%s\n",
+                job->frames, status, (unsigned long long)job->frame_hash,
+                (unsigned long long)job->ram_hash, job->ms, fps, i + 1 < queue->len ? "," : "");
+        } else {
+            // quote the path, it may contain commas
+            fputc('"', out);
+            for(const char* c = job->path; *c; c++) {
+                if(*c == '"')
+                    fputc('"', out);
+                fputc(*c, out);
+            }
+            fprintf(out, "\",%u,%s,%016llx,%016llx,%.3f,%.1f\n",
+                job->frames, status, (unsigned long long)job->frame_hash,
+                (unsigned long long)job->ram_hash, job->ms, fps);
+        }
+    }
+    if(json)
+        fprintf(out, "  ]\n}\n");
+}
+
+int run_batch(int argc, char *argv[]) {
+    if(argc < 3) {
+        LOG(ERROR, "Usage: %s --batch <list> [-j threads] [--frames N] [--report file.csv|file.json]", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    BatchQueue queue;
+    memset(&queue, 0, sizeof(BatchQueue));
+    int threads = SDL_GetCPUCount();
+    uint32_t frames = DEFAULT_BATCH_FRAMES;
+    const char* report_path = NULL;
+
+    for(int i = 3; i < argc; i++) {
+        if(strcmp(argv[i], "-j") != 0 && strcmp(argv[i], "--frames") != 0 && strcmp(argv[i], "--report") != 0) {
+            LOG(ERROR, "Unknown option %s", argv[i]);
+            return EXIT_FAILURE;
+        }
+        if(i + 1 >= argc) {
+            LOG(ERROR, "%s option requires an argument", argv[i]);
+            return EXIT_FAILURE;
+        }
+        if(strcmp(argv[i], "-j") == 0) {
+            threads = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--frames") == 0) {
+            frames = strtoul(argv[++i], NULL, 10);
+            if(!frames) {
+                LOG(ERROR, "--frames expects a frame count");
+                return EXIT_FAILURE;
+            }
+        } else {
+            report_path = argv[++i];
+        }
+    }
+
+    if(!read_list(&queue, argv[2], frames))
+        return EXIT_FAILURE;
+    if(!queue.len) {
+        LOG(ERROR, "No ROMs to run");
+        return EXIT_FAILURE;
+    }
+    threads = threads < 1 ? 1 : threads > (int)queue.len ? (int)queue.len : threads;
+    LOG(INFO, "Running %zu jobs on %d threads", queue.len, threads);
+
+    Timer timer;
+    init_timer(&timer, 0);
+    mark_start(&timer);
+
+    BatchWorker* workers = calloc(threads, sizeof(BatchWorker));
+    for(int i = 0; i < threads; i++) {
+        workers[i].queue = &queue;
+        workers[i].thread = SDL_CreateThread(batch_worker, "batch_worker", &workers[i]);
+    }
+    for(int i = 0; i < threads; i++)
+        SDL_WaitThread(workers[i].thread, NULL);
+
+    mark_end(&timer);
+    double wall_ms = get_diff_ms(&timer);
+    release_timer(&timer);
+
+    size_t done = 0;
+    uint64_t total_frames = 0;
+    for(size_t i = 0; i < queue.len; i++) {
+        if(!queue.jobs[i].done)
+            continue;
+        done++;
+        total_frames += queue.jobs[i].frames;
+    }
+    LOG(INFO, "Ran %zu/%zu jobs, %llu frames in %.1f s, %.1f fps",
+        done, queue.len, (unsigned long long)total_frames, wall_ms / 1000,
+        total_frames * 1000.0 / (wall_ms > 0 ? wall_ms : 1));
+
+    int code = done == queue.len ? EXIT_SUCCESS : EXIT_FAILURE;
+    FILE* report = stdout;
+    if(report_path != NULL) {
+        report = fopen(report_path, "w");
+        if(report == NULL) {
+            LOG(ERROR, "Could not create %s", report_path);
+            report = stdout;
+            code = EXIT_FAILURE;
+        }
+    }
+    uint8_t json = report_path != NULL && has_extension(report_path, ".json");
+    write_report(report, &queue, json, wall_ms);
+    if(report != stdout)
+        fclose(report);
+
+    free(workers);
+    for(size_t i = 0; i < queue.len; i++) {
+        free((char*)queue.jobs[i].path);
+        free((char*)queue.jobs[i].movie);
+    }
+    free(queue.jobs);
+    return code;
+}
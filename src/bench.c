@@ -0,0 +1,757 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "emulator.h"
+#include "nsf.h"
+#include "timers.h"
+#include "utils.h"
+
+#define DEFAULT_BENCH_FRAMES 1800
+#define DEFAULT_BENCH_RUNS 3
+// runs slower than the local timings by more than this many percent fail
+#define DEFAULT_BENCH_THRESHOLD 10.0
+// scripted input holds each random button mask for this many frames
+#define INPUT_HOLD_FRAMES 8
+#define CHR_SIZE 0x2000
+#define MAX_LINE 256
+
+// The workloads are built in memory from the 6502 programs below, so the
+// suite needs no ROM files and every host runs exactly the same code.
+
+// arithmetic over a page of RAM with rendering off, the result
+// is written to the backdrop colour every NMI
+static const uint8_t cpu_code[] = {
+    0x78, // reset: sei
+    0xd8, // cld
+    0xa2, 0xff, // ldx #$ff
+    0x9a, // txs
+    0xe8, // inx
+    0x8e, 0x00, 0x20, // stx $2000
+    0x8e, 0x01, 0x20, // stx $2001
+    0x8e, 0x10, 0x40, // stx $4010
+    0xa9, 0x40, // lda #$40
+    0x8d, 0x17, 0x40, // sta $4017
+    0x2c, 0x02, 0x20, // vblank1: bit $2002
+    0x10, 0xfb, // bpl vblank1
+    0x2c, 0x02, 0x20, // vblank2: bit $2002
+    0x10, 0xfb, // bpl vblank2
+    0xa9, 0x00, // lda #$00
+    0x85, 0x00, // sta $00
+    0x85, 0x01, // sta $01
+    0xa9, 0x80, // lda #$80
+    0x8d, 0x00, 0x20, // sta $2000
+    0xa2, 0x00, // main: ldx #$00
+    0xbd, 0x00, 0x03, // sum: lda $0300,x
+    0x65, 0x00, // adc $00
+    0x9d, 0x00, 0x03, // sta $0300,x
+    0x45, 0x01, // eor $01
+    0x85, 0x01, // sta $01
+    0x26, 0x02, // rol $02
+    0xe8, // inx
+    0xd0, 0xef, // bne sum
+    0xe6, 0x00, // inc $00
+    0x4c, 0x29, 0xc0, // jmp main
+    0x48, // nmi: pha
+    0x8a, // txa
+    0x48, // pha
+    0xa9, 0x3f, // lda #$3f
+    0x8d, 0x06, 0x20, // sta $2006
+    0xa9, 0x00, // lda #$00
+    0x8d, 0x06, 0x20, // sta $2006
+    0xa5, 0x01, // lda $01
+    0x29, 0x3f, // and #$3f
+    0x8d, 0x07, 0x20, // sta $2007
+    0xa9, 0x01, // lda #$01
+    0x8d, 0x16, 0x40, // sta $4016
+    0xa9, 0x00, // lda #$00
+    0x8d, 0x16, 0x40, // sta $4016
+    0xa2, 0x08, // ldx #$08
+    0xad, 0x16, 0x40, // pad: lda $4016
+    0x4a, // lsr
+    0x26, 0x03, // rol $03
+    0xca, // dex
+    0xd0, 0xf7, // bne pad
+    0xa5, 0x03, // lda $03
+    0x45, 0x00, // eor $00
+    0x85, 0x00, // sta $00
+    0x68, // pla
+    0xaa, // tax
+    0x68, // pla
+    0x40, // rti
+    0x40, // irq: rti
+};
+
+// 64 sprites moved and copied with OAM DMA every frame over a full
+// background, a sprite zero hit splits the scroll mid-frame
+static const uint8_t sprites_code[] = {
+    0x78, // reset: sei
+    0xd8, // cld
+    0xa2, 0xff, // ldx #$ff
+    0x9a, // txs
+    0xe8, // inx
+    0x8e, 0x00, 0x20, // stx $2000
+    0x8e, 0x01, 0x20, // stx $2001
+    0x8e, 0x10, 0x40, // stx $4010
+    0xa9, 0x40, // lda #$40
+    0x8d, 0x17, 0x40, // sta $4017
+    0x2c, 0x02, 0x20, // vblank1: bit $2002
+    0x10, 0xfb, // bpl vblank1
+    0x2c, 0x02, 0x20, // vblank2: bit $2002
+    0x10, 0xfb, // bpl vblank2
+    0xa9, 0x3f, // lda #$3f
+    0x8d, 0x06, 0x20, // sta $2006
+    0xa9, 0x00, // lda #$00
+    0x8d, 0x06, 0x20, // sta $2006
+    0xa2, 0x00, // ldx #$00
+    0xbd, 0xca, 0xc0, // palette: lda palettes,x
+    0x8d, 0x07, 0x20, // sta $2007
+    0xe8, // inx
+    0xe0, 0x20, // cpx #$20
+    0xd0, 0xf5, // bne palette
+    0xa9, 0x20, // lda #$20
+    0x8d, 0x06, 0x20, // sta $2006
+    0xa9, 0x00, // lda #$00
+    0x8d, 0x06, 0x20, // sta $2006
+    0xa0, 0x04, // ldy #$04
+    0x8e, 0x07, 0x20, // tiles: stx $2007
+    0xe8, // inx
+    0xd0, 0xfa, // bne tiles
+    0x88, // dey
+    0xd0, 0xf7, // bne tiles
+    0x8a, // oam: txa
+    0x9d, 0x00, 0x02, // sta $0200,x
+    0x9d, 0x03, 0x02, // sta $0203,x
+    0x4a, // lsr
+    0x4a, // lsr
+    0x9d, 0x01, 0x02, // sta $0201,x
+    0x29, 0x03, // and #$03
+    0x9d, 0x02, 0x02, // sta $0202,x
+    0xe8, // inx
+    0xe8, // inx
+    0xe8, // inx
+    0xe8, // inx
+    0xd0, 0xe9, // bne oam
+    0xa9, 0x80, // lda #$80
+    0x8d, 0x00, 0x20, // sta $2000
+    0xa9, 0x1e, // lda #$1e
+    0x8d, 0x01, 0x20, // sta $2001
+    0x2c, 0x02, 0x20, // main: bit $2002
+    0x70, 0xfb, // bvs main
+    0x2c, 0x02, 0x20, // hit: bit $2002
+    0x50, 0xfb, // bvc hit
+    0xa5, 0x04, // lda $04
+    0x8d, 0x05, 0x20, // sta $2005
+    0xa9, 0x00, // lda #$00
+    0x8d, 0x05, 0x20, // sta $2005
+    0x4c, 0x6b, 0xc0, // jmp main
+    0x48, // nmi: pha
+    0x8a, // txa
+    0x48, // pha
+    0xa9, 0x00, // lda #$00
+    0x8d, 0x03, 0x20, // sta $2003
+    0xa9, 0x02, // lda #$02
+    0x8d, 0x14, 0x40, // sta $4014
+    0xa2, 0x04, // ldx #$04
+    0xfe, 0x03, 0x02, // move: inc $0203,x
+    0xfe, 0x00, 0x02, // inc $0200,x
+    0xe8, // inx
+    0xe8, // inx
+    0xe8, // inx
+    0xe8, // inx
+    0xd0, 0xf4, // bne move
+    0xa9, 0x00, // lda #$00
+    0x8d, 0x05, 0x20, // sta $2005
+    0x8d, 0x05, 0x20, // sta $2005
+    0xa9, 0x80, // lda #$80
+    0x8d, 0x00, 0x20, // sta $2000
+    0xa9, 0x01, // lda #$01
+    0x8d, 0x16, 0x40, // sta $4016
+    0xa9, 0x00, // lda #$00
+    0x8d, 0x16, 0x40, // sta $4016
+    0xa2, 0x08, // ldx #$08
+    0xad, 0x16, 0x40, // pad: lda $4016
+    0x4a, // lsr
+    0x26, 0x03, // rol $03
+    0xca, // dex
+    0xd0, 0xf7, // bne pad
+    0xa5, 0x03, // lda $03
+    0x65, 0x04, // adc $04
+    0x85, 0x04, // sta $04
+    0x68, // pla
+    0xaa, // tax
+    0x68, // pla
+    0x40, // rti
+    0x40, // irq: rti
+    0x0f, 0x01, 0x11, 0x21, 0x0f, 0x06, 0x16, 0x26, 0x0f, 0x09, 0x19, 0x29, 0x0f, 0x02, 0x12, 0x22, // palettes: background
+    0x0f, 0x14, 0x24, 0x34, 0x0f, 0x17, 0x27, 0x37, 0x0f, 0x1a, 0x2a, 0x3a, 0x0f, 0x13, 0x23, 0x33, // sprites
+};
+
+// every channel playing, the DMC looping its longest sample at the
+// highest rate while the NMI sweeps the pulse and noise periods
+static const uint8_t dmc_code[] = {
+    0x78, // reset: sei
+    0xd8, // cld
+    0xa2, 0xff, // ldx #$ff
+    0x9a, // txs
+    0xe8, // inx
+    0x8e, 0x00, 0x20, // stx $2000
+    0x8e, 0x01, 0x20, // stx $2001
+    0x8e, 0x10, 0x40, // stx $4010
+    0xa9, 0x40, // lda #$40
+    0x8d, 0x17, 0x40, // sta $4017
+    0x2c, 0x02, 0x20, // vblank1: bit $2002
+    0x10, 0xfb, // bpl vblank1
+    0x2c, 0x02, 0x20, // vblank2: bit $2002
+    0x10, 0xfb, // bpl vblank2
+    0xa9, 0x4f, // lda #$4f
+    0x8d, 0x10, 0x40, // sta $4010
+    0xa9, 0x40, // lda #$40
+    0x8d, 0x11, 0x40, // sta $4011
+    0xa9, 0x00, // lda #$00
+    0x8d, 0x12, 0x40, // sta $4012
+    0xa9, 0xff, // lda #$ff
+    0x8d, 0x13, 0x40, // sta $4013
+    0xa9, 0xbf, // lda #$bf
+    0x8d, 0x00, 0x40, // sta $4000
+    0xa9, 0x7f, // lda #$7f
+    0x8d, 0x04, 0x40, // sta $4004
+    0xa9, 0x00, // lda #$00
+    0x8d, 0x01, 0x40, // sta $4001
+    0x8d, 0x05, 0x40, // sta $4005
+    0x8d, 0x03, 0x40, // sta $4003
+    0x8d, 0x07, 0x40, // sta $4007
+    0x8d, 0x0b, 0x40, // sta $400b
+    0x8d, 0x0f, 0x40, // sta $400f
+    0xa9, 0xff, // lda #$ff
+    0x8d, 0x08, 0x40, // sta $4008
+    0xa9, 0x3f, // lda #$3f
+    0x8d, 0x0c, 0x40, // sta $400c
+    0xa9, 0x1f, // lda #$1f
+    0x8d, 0x15, 0x40, // sta $4015
+    0xa9, 0x80, // lda #$80
+    0x8d, 0x00, 0x20, // sta $2000
+    0x4c, 0x64, 0xc0, // main: jmp main
+    0x48, // nmi: pha
+    0x8a, // txa
+    0x48, // pha
+    0xe6, 0x00, // inc $00
+    0xa5, 0x00, // lda $00
+    0x8d, 0x02, 0x40, // sta $4002
+    0x49, 0xff, // eor #$ff
+    0x8d, 0x06, 0x40, // sta $4006
+    0x8d, 0x0a, 0x40, // sta $400a
+    0x29, 0x0f, // and #$0f
+    0x8d, 0x0e, 0x40, // sta $400e
+    0xa9, 0x01, // lda #$01
+    0x8d, 0x16, 0x40, // sta $4016
+    0xa9, 0x00, // lda #$00
+    0x8d, 0x16, 0x40, // sta $4016
+    0xa2, 0x08, // ldx #$08
+    0xad, 0x16, 0x40, // pad: lda $4016
+    0x4a, // lsr
+    0x26, 0x03, // rol $03
+    0xca, // dex
+    0xd0, 0xf7, // bne pad
+    0xa5, 0x03, // lda $03
+    0x09, 0xb0, // ora #$b0
+    0x8d, 0x00, 0x40, // sta $4000
+    0xad, 0x15, 0x40, // lda $4015
+    0x29, 0x10, // and #$10
+    0xd0, 0x05, // bne playing
+    0xa9, 0x1f, // lda #$1f
+    0x8d, 0x15, 0x40, // sta $4015
+    0x68, // playing: pla
+    0xaa, // tax
+    0x68, // pla
+    0x40, // rti
+    0x40, // irq: rti
+};
+
+// MMC3 scanline IRQ every 8 lines switching both PRG banks and the
+// scroll, the main loop reads from the switched banks
+static const uint8_t mmc3_code[] = {
+    0x78, // reset: sei
+    0xd8, // cld
+    0xa2, 0xff, // ldx #$ff
+    0x9a, // txs
+    0xe8, // inx
+    0x8e, 0x00, 0x20, // stx $2000
+    0x8e, 0x01, 0x20, // stx $2001
+    0x8e, 0x10, 0x40, // stx $4010
+    0xa9, 0x40, // lda #$40
+    0x8d, 0x17, 0x40, // sta $4017
+    0x2c, 0x02, 0x20, // vblank1: bit $2002
+    0x10, 0xfb, // bpl vblank1
+    0x2c, 0x02, 0x20, // vblank2: bit $2002
+    0x10, 0xfb, // bpl vblank2
+    0xa9, 0x00, // lda #$00
+    0x8d, 0x00, 0xa0, // sta $a000
+    0xa9, 0x80, // lda #$80
+    0x8d, 0x00, 0x20, // sta $2000
+    0xa9, 0x18, // lda #$18
+    0x8d, 0x01, 0x20, // sta $2001
+    0x58, // cli
+    0xbd, 0x00, 0x80, // main: lda $8000,x
+    0x7d, 0x00, 0xa0, // adc $a000,x
+    0x85, 0x05, // sta $05
+    0xe8, // inx
+    0x4c, 0x2e, 0xe0, // jmp main
+    0x48, // nmi: pha
+    0x8a, // txa
+    0x48, // pha
+    0xa9, 0x3f, // lda #$3f
+    0x8d, 0x06, 0x20, // sta $2006
+    0xa9, 0x00, // lda #$00
+    0x8d, 0x06, 0x20, // sta $2006
+    0xa5, 0x05, // lda $05
+    0x29, 0x3f, // and #$3f
+    0x8d, 0x07, 0x20, // sta $2007
+    0xa9, 0x00, // lda #$00
+    0x85, 0x06, // sta $06
+    0x8d, 0x05, 0x20, // sta $2005
+    0x8d, 0x05, 0x20, // sta $2005
+    0xa9, 0x80, // lda #$80
+    0x8d, 0x00, 0x20, // sta $2000
+    0xa9, 0x07, // lda #$07
+    0x8d, 0x00, 0xc0, // sta $c000
+    0x8d, 0x01, 0xc0, // sta $c001
+    0x8d, 0x01, 0xe0, // sta $e001
+    0xa9, 0x01, // lda #$01
+    0x8d, 0x16, 0x40, // sta $4016
+    0xa9, 0x00, // lda #$00
+    0x8d, 0x16, 0x40, // sta $4016
+    0xa2, 0x08, // ldx #$08
+    0xad, 0x16, 0x40, // pad: lda $4016
+    0x4a, // lsr
+    0x26, 0x03, // rol $03
+    0xca, // dex
+    0xd0, 0xf7, // bne pad
+    0x68, // pla
+    0xaa, // tax
+    0x68, // pla
+    0x40, // rti
+    0x48, // irq: pha
+    0x8a, // txa
+    0x48, // pha
+    0x8d, 0x00, 0xe0, // sta $e000
+    0x8d, 0x01, 0xe0, // sta $e001
+    0xe6, 0x06, // inc $06
+    0xa9, 0x06, // lda #$06
+    0x8d, 0x00, 0x80, // sta $8000
+    0xa5, 0x06, // lda $06
+    0x29, 0x03, // and #$03
+    0x8d, 0x01, 0x80, // sta $8001
+    0xa9, 0x07, // lda #$07
+    0x8d, 0x00, 0x80, // sta $8000
+    0xa5, 0x06, // lda $06
+    0x45, 0x03, // eor $03
+    0x29, 0x03, // and #$03
+    0x8d, 0x01, 0x80, // sta $8001
+    0xa5, 0x06, // lda $06
+    0x8d, 0x05, 0x20, // sta $2005
+    0x8d, 0x05, 0x20, // sta $2005
+    0x68, // pla
+    0xaa, // tax
+    0x68, // pla
+    0x40, // rti
+};
+
+// NSF play routine driving all channels plus a page of busy work
+static const uint8_t nsf_code[] = {
+    0xa9, 0x0f, // init: lda #$0f
+    0x8d, 0x15, 0x40, // sta $4015
+    0xa9, 0x00, // lda #$00
+    0x85, 0x00, // sta $00
+    0x60, // rts
+    0xe6, 0x00, // play: inc $00
+    0xa5, 0x00, // lda $00
+    0x8d, 0x02, 0x40, // sta $4002
+    0x4a, // lsr
+    0x8d, 0x06, 0x40, // sta $4006
+    0x8d, 0x0a, 0x40, // sta $400a
+    0xa9, 0xbf, // lda #$bf
+    0x8d, 0x00, 0x40, // sta $4000
+    0xa9, 0x7f, // lda #$7f
+    0x8d, 0x04, 0x40, // sta $4004
+    0xa9, 0xff, // lda #$ff
+    0x8d, 0x08, 0x40, // sta $4008
+    0xa5, 0x00, // lda $00
+    0x29, 0x0f, // and #$0f
+    0x8d, 0x0e, 0x40, // sta $400e
+    0xd0, 0x11, // bne mix
+    0x8d, 0x03, 0x40, // sta $4003
+    0x8d, 0x07, 0x40, // sta $4007
+    0x8d, 0x0b, 0x40, // sta $400b
+    0x8d, 0x0f, 0x40, // sta $400f
+    0xa9, 0x3f, // lda #$3f
+    0x8d, 0x0c, 0x40, // sta $400c
+    0xa2, 0x00, // mix: ldx #$00
+    0xbd, 0x00, 0x03, // work: lda $0300,x
+    0x65, 0x00, // adc $00
+    0x9d, 0x00, 0x03, // sta $0300,x
+    0xe8, // inx
+    0xd0, 0xf5, // bne work
+    0x60, // rts
+};
+
+typedef enum WorkloadType {
+    WORKLOAD_NROM,
+    WORKLOAD_MMC3,
+    WORKLOAD_NSF,
+} WorkloadType;
+
+typedef struct Workload {
+    const char* name;
+    WorkloadType type;
+    const uint8_t* code;
+    size_t size;
+    uint16_t org;
+    // NMI and IRQ vectors, init and play addresses for NSF
+    uint16_t nmi;
+    uint16_t irq;
+} Workload;
+
+static const Workload workloads[] = {
+    {"cpu", WORKLOAD_NROM, cpu_code, sizeof(cpu_code), 0xc000, 0xc041, 0xc074},
+    {"sprites", WORKLOAD_NROM, sprites_code, sizeof(sprites_code), 0xc000, 0xc082, 0xc0c9},
+    {"dmc", WORKLOAD_NROM, dmc_code, sizeof(dmc_code), 0xc000, 0xc067, 0xc0aa},
+    {"mmc3", WORKLOAD_MMC3, mmc3_code, sizeof(mmc3_code), 0xe000, 0xe03a, 0xe081},
+    {"nsf", WORKLOAD_NSF, nsf_code, sizeof(nsf_code), 0x8000, 0x8000, 0x800a},
+};
+#define WORKLOAD_COUNT (sizeof(workloads) / sizeof(Workload))
+
+typedef struct BenchResult {
+    double fps;
+    double mhz;
+    // every frame and audio sample of the run
+    uint64_t hash;
+    uint8_t deterministic;
+} BenchResult;
+
+// one line of a baseline, the hash for the committed file and the
+// frame rate for the local timings file
+typedef struct Baseline {
+    char name[32];
+    uint32_t frames;
+    uint64_t hash;
+    double fps;
+} Baseline;
+
+
+static void fill_pattern(uint8_t* data, size_t size, uint8_t seed) {
+    // arbitrary non zero data for unused PRG and the tiles
+    for(size_t i = 0; i < size; i++)
+        data[i] = (uint8_t)(i * 31 + (i >> 8) * 7 + seed);
+}
+
+static size_t build_rom(const Workload* workload, uint8_t* image) {
+    // NROM-128 or MMC3 with 32KB PRG, the code sits in the last bank
+    size_t prg_size = workload->type == WORKLOAD_MMC3 ? 0x8000 : 0x4000;
+    uint8_t header[INES_HEADER_SIZE] = {'N', 'E', 'S', 0x1a, prg_size / 0x4000, 1};
+    if(workload->type == WORKLOAD_MMC3)
+        header[6] = 0x40;
+    memcpy(image, header, INES_HEADER_SIZE);
+    uint8_t* prg = image + INES_HEADER_SIZE;
+    for(size_t bank = 0; bank < prg_size / 0x2000; bank++)
+        fill_pattern(prg + bank * 0x2000, 0x2000, bank * 0x55);
+    memcpy(prg + prg_size - (0x10000 - workload->org), workload->code, workload->size);
+    uint16_t vectors[3] = {workload->nmi, workload->org, workload->irq};
+    for(int i = 0; i < 3; i++) {
+        prg[prg_size - 6 + i * 2] = vectors[i] & 0xff;
+        prg[prg_size - 5 + i * 2] = vectors[i] >> 8;
+    }
+    fill_pattern(prg + prg_size, CHR_SIZE, 0x3c);
+    return INES_HEADER_SIZE + prg_size + CHR_SIZE;
+}
+
+static size_t build_nsf(const Workload* workload, uint8_t* image) {
+    memset(image, 0, NSF_HEADER_SIZE);
+    memcpy(image, "NESM\x1a", 5);
+    image[5] = 1;
+    // one song starting at 1
+    image[6] = image[7] = 1;
+    image[8] = workload->org & 0xff;
+    image[9] = workload->org >> 8;
+    image[0xa] = workload->nmi & 0xff;
+    image[0xb] = workload->nmi >> 8;
+    image[0xc] = workload->irq & 0xff;
+    image[0xd] = workload->irq >> 8;
+    strcpy((char*)image + 0xe, "bench");
+    // 16639 us, the NTSC frame period
+    image[0x6e] = 16639 & 0xff;
+    image[0x6f] = 16639 >> 8;
+    memcpy(image + NSF_HEADER_SIZE, workload->code, workload->size);
+    return NSF_HEADER_SIZE + workload->size;
+}
+
+static uint16_t next_input(uint32_t* state, uint32_t frame, uint16_t input) {
+    // the same pseudo random button masks on every run
+    if(frame % INPUT_HOLD_FRAMES)
+        return input;
+    *state = *state * 1103515245 + 12345;
+    return (*state >> 16) & 0xff;
+}
+
+static void run_rom(Emulator* emulator, uint32_t frames, uint64_t* hash, uint64_t* ns) {
+    uint32_t seed = 1;
+    uint16_t input = 0;
+    for(uint32_t i = 0; i < frames; i++) {
+        input = next_input(&seed, i, input);
+        emulator->mem.joy1.status = input;
+        uint64_t start = time_ns();
+        uint32_t* screen = step_frame(emulator);
+        *ns += time_ns() - start;
+        *hash = hash_bytes(screen, VISIBLE_DOTS * VISIBLE_SCANLINES * sizeof(uint32_t), *hash);
+        *hash = hash_bytes(emulator->apu.buff, emulator->apu.sampler.index * sizeof(int16_t), *hash);
+    }
+}
+
+static void run_nsf(Emulator* emulator, uint32_t frames, uint64_t* hash, uint64_t* ns) {
+    // the same steps as rendering a track to WAV, one play call per frame
+    NSF* nsf = emulator->mapper.NSF;
+    APU* apu = &emulator->apu;
+    size_t cycles_per_frame = nsf->speed * NTSC_CPU_CLOCK / 1000000;
+    size_t slice = (AUDIO_BUFF_SIZE / 2) * (size_t)(NTSC_CPU_CLOCK / SAMPLING_FREQUENCY);
+    init_song(emulator, 1);
+    lock_sample_rate(apu, NTSC_CPU_CLOCK);
+    for(uint32_t i = 0; i < frames; i++) {
+        uint64_t start = time_ns();
+        if(emulator->cpu.pc == NSF_SENTINEL_ADDR && !nsf->initializing)
+            nsf_jsr(emulator, nsf->play_addr);
+        for(size_t cycles = 0; cycles < cycles_per_frame; cycles += slice) {
+            run_NSF_cycles(emulator, nsf, MIN(slice, cycles_per_frame - cycles));
+            *hash = hash_bytes(apu->buff, apu->sampler.index * sizeof(int16_t), *hash);
+            apu->sampler.index = 0;
+        }
+        *ns += time_ns() - start;
+        if(emulator->cpu.pc == NSF_SENTINEL_ADDR)
+            nsf->initializing = 0;
+    }
+    // parked cycles are not counted by the CPU
+    emulator->cpu.t_cycles = (uint64_t)frames * cycles_per_frame;
+}
+
+static BenchResult run_workload(const Workload* workload, uint32_t frames) {
+    static uint8_t image[INES_HEADER_SIZE + 0x8000 + CHR_SIZE];
+    size_t size = workload->type == WORKLOAD_NSF ? build_nsf(workload, image) : build_rom(workload, image);
+
+    Emulator* emulator = calloc(1, sizeof(Emulator));
+    emulator->settings.headless = true;
+    SDL_RWops* file = SDL_RWFromConstMem(image, (int)size);
+    load_ROM(file, NULL, NULL, NULL, &emulator->mapper);
+    SDL_RWclose(file);
+    if(workload->type == WORKLOAD_NSF) {
+        // the player sets up the NSF, init_emulator_core does not
+        emulator->type = emulator->mapper.type;
+        emulator->mapper.emulator = emulator;
+        init_mem(emulator);
+        init_ppu(emulator);
+        init_cpu(emulator);
+        init_APU(emulator);
+    } else {
+        init_emulator_core(emulator);
+    }
+
+    uint64_t hash = FNV_OFFSET, ns = 0;
+    if(workload->type == WORKLOAD_NSF)
+        run_nsf(emulator, frames, &hash, &ns);
+    else
+        run_rom(emulator, frames, &hash, &ns);
+
+    BenchResult result;
+    result.hash = hash;
+    result.fps = ns ? frames * 1e9 / ns : 0;
+    result.mhz = ns ? emulator->cpu.t_cycles * 1e3 / ns : 0;
+    result.deterministic = 1;
+    if(workload->type == WORKLOAD_NSF) {
+        free_mapper(&emulator->mapper);
+        exit_ppu(&emulator->ppu);
+    } else {
+        free_emulator(emulator);
+    }
+    free(emulator);
+    return result;
+}
+
+static size_t read_baseline(const char* path, Baseline* baseline, size_t max, uint8_t timings) {
+    // workload,frames,hash or workload,frames,fps with a header line
+    FILE* file = fopen(path, "r");
+    if(file == NULL)
+        return 0;
+    char line[MAX_LINE];
+    size_t count = 0;
+    while(count < max && fgets(line, sizeof(line), file) != NULL) {
+        Baseline* entry = &baseline[count];
+        memset(entry, 0, sizeof(Baseline));
+        unsigned long long hash;
+        if(timings) {
+            if(sscanf(line, "%31[^,],%u,%lf", entry->name, &entry->frames, &entry->fps) == 3)
+                count++;
+        } else if(sscanf(line, "%31[^,],%u,%llx", entry->name, &entry->frames, &hash) == 3) {
+            entry->hash = hash;
+            count++;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+static int write_baseline(const char* path, const BenchResult* results, uint32_t frames, uint8_t timings) {
+    FILE* file = fopen(path, "w");
+    if(file == NULL) {
+        LOG(ERROR, "Could not create %s", path);
+        return -1;
+    }
+    fprintf(file, timings ? "workload,frames,fps\n" : "workload,frames,hash\n");
+    for(size_t i = 0; i < WORKLOAD_COUNT; i++) {
+        if(timings)
+            fprintf(file, "%s,%u,%.1f\n", workloads[i].name, frames, results[i].fps);
+        else
+            fprintf(file, "%s,%u,%016llx\n", workloads[i].name, frames, (unsigned long long)results[i].hash);
+    }
+    fclose(file);
+    LOG(INFO, "Wrote baseline %s", path);
+    return 0;
+}
+
+static const Baseline* find_baseline(const Baseline* baseline, size_t count, const char* name) {
+    for(size_t i = 0; i < count; i++) {
+        if(strcmp(baseline[i].name, name) == 0)
+            return &baseline[i];
+    }
+    return NULL;
+}
+
+int run_bench(int argc, char *argv[]) {
+    uint32_t frames = DEFAULT_BENCH_FRAMES;
+    int runs = DEFAULT_BENCH_RUNS;
+    double threshold = DEFAULT_BENCH_THRESHOLD;
+    const char* baseline_path = NULL;
+    // frame rates only mean something on the machine that recorded them
+    const char* timings_path = NULL;
+    uint8_t update = 0;
+
+    for(int i = 2; i < argc; i++) {
+        if(strcmp(argv[i], "--update") == 0) {
+            update = 1;
+            continue;
+        }
+        if(strcmp(argv[i], "--frames") != 0 && strcmp(argv[i], "--runs") != 0
+            && strcmp(argv[i], "--baseline") != 0 && strcmp(argv[i], "--timings") != 0
+            && strcmp(argv[i], "--threshold") != 0) {
+            LOG(ERROR, "Unknown option %s", argv[i]);
+            return EXIT_FAILURE;
+        }
+        if(i + 1 >= argc) {
+            LOG(ERROR, "%s option requires an argument", argv[i]);
+            return EXIT_FAILURE;
+        }
+        if(strcmp(argv[i], "--frames") == 0) {
+            frames = strtoul(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "--runs") == 0) {
+            runs = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--baseline") == 0) {
+            baseline_path = argv[++i];
+        } else if(strcmp(argv[i], "--timings") == 0) {
+            timings_path = argv[++i];
+        } else {
+            threshold = atof(argv[++i]);
+        }
+    }
+    if(!frames || runs < 1) {
+        LOG(ERROR, "--frames and --runs expect a positive count");
+        return EXIT_FAILURE;
+    }
+    if(update && baseline_path == NULL && timings_path == NULL) {
+        LOG(ERROR, "--update needs --baseline <file> or --timings <file>");
+        return EXIT_FAILURE;
+    }
+
+    Baseline baseline[WORKLOAD_COUNT];
+    Baseline timings[WORKLOAD_COUNT];
+    size_t baseline_count = 0, timings_count = 0;
+    if(baseline_path != NULL && !update) {
+        baseline_count = read_baseline(baseline_path, baseline, WORKLOAD_COUNT, 0);
+        if(!baseline_count)
+            LOG(WARN, "No baseline in %s, only reporting", baseline_path);
+    }
+    if(timings_path != NULL && !update) {
+        timings_count = read_baseline(timings_path, timings, WORKLOAD_COUNT, 1);
+        if(!timings_count)
+            LOG(INFO, "No timings in %s, frame rates are not compared", timings_path);
+    }
+
+    LOG(INFO, "Running %zu workloads for %u frames, best of %d", WORKLOAD_COUNT, frames, runs);
+    BenchResult results[WORKLOAD_COUNT];
+    for(size_t i = 0; i < WORKLOAD_COUNT; i++) {
+        // the fastest run is the one least disturbed by the rest of the system
+        results[i] = run_workload(&workloads[i], frames);
+        for(int run = 1; run < runs; run++) {
+            BenchResult result = run_workload(&workloads[i], frames);
+            results[i].deterministic &= result.hash == results[i].hash;
+            results[i].fps = MAX(results[i].fps, result.fps);
+            results[i].mhz = MAX(results[i].mhz, result.mhz);
+        }
+    }
+
+    int code = EXIT_SUCCESS;
+    printf("%-10s %8s %10s %8s  %-16s  %s\n", "workload", "frames", "fps", "MHz", "hash", "result");
+    for(size_t i = 0; i < WORKLOAD_COUNT; i++) {
+        const BenchResult* result = &results[i];
+        const Baseline* base = find_baseline(baseline, baseline_count, workloads[i].name);
+        const Baseline* timing = find_baseline(timings, timings_count, workloads[i].name);
+        char verdict[64] = "ok";
+        if(!result->deterministic) {
+            strcpy(verdict, "FAIL: hash differs between runs");
+            code = EXIT_FAILURE;
+        } else if(update) {
+            strcpy(verdict, "recorded");
+        } else if(base == NULL) {
+            strcpy(verdict, "no baseline");
+        } else if(base->frames != frames) {
+            snprintf(verdict, sizeof(verdict), "baseline ran %u frames", base->frames);
+        } else if(base->hash != result->hash) {
+            strcpy(verdict, "FAIL: hash differs from baseline");
+            code = EXIT_FAILURE;
+        } else if(timing != NULL && timing->frames == frames && timing->fps > 0) {
+            double change = (result->fps / timing->fps - 1) * 100;
+            if(change < -threshold) {
+                snprintf(verdict, sizeof(verdict), "FAIL: %+.1f%% fps", change);
+                code = EXIT_FAILURE;
+            } else {
+                snprintf(verdict, sizeof(verdict), "ok (%+.1f%% fps)", change);
+            }
+        }
+        printf("%-10s %8u %10.1f %8.2f  %016llx  %s\n", workloads[i].name, frames, result->fps,
+            result->mhz, (unsigned long long)result->hash, verdict);
+    }
+
+    if(update && baseline_path != NULL && write_baseline(baseline_path, results, frames, 0) < 0)
+        code = EXIT_FAILURE;
+    if(update && timings_path != NULL && write_baseline(timings_path, results, frames, 1) < 0)
+        code = EXIT_FAILURE;
+    return code;
+}
@@ -0,0 +1,25 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+// runs the built in benchmark workloads, compared against a baseline file
+int run_bench(int argc, char *argv[]);
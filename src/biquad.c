@@ -94,6 +94,27 @@ double biquad(double sample, Biquad * b)
     return result;
 }
 
+/* Computes a BiQuad filter on the same sample count times in a row */
+double biquad_hold(double sample, Biquad * b, size_t count)
+{
+    double x1 = b->x1, x2 = b->x2, y1 = b->y1, y2 = b->y2;
+
+    while(count--) {
+        double result = b->a0 * sample + b->a1 * x1 + b->a2 * x2 -
+            b->a3 * y1 - b->a4 * y2;
+        x2 = x1;
+        x1 = sample;
+        y2 = y1;
+        y1 = result;
+    }
+
+    b->x1 = x1;
+    b->x2 = x2;
+    b->y1 = y1;
+    b->y2 = y2;
+    return y1;
+}
+
 /* sets up a BiQuad Filter */
 void biquad_init(Biquad* b, int type, double dbGain, double freq,
 double srate, double bandwidth)
@@ -42,6 +42,8 @@
 
 # pragma once
 
+#include <stddef.h>
+
 /* this holds the data required to update samples thru a filter */
 typedef struct {
     double a0, a1, a2, a3, a4;
@@ -61,6 +63,8 @@ enum {
 
 double biquad(double sample, Biquad *b);
 
+double biquad_hold(double sample, Biquad *b, size_t count);
+
 void biquad_init(Biquad* b, int type,
                    double dbGain, /* gain of filter */
                    double freq, /* center frequency */
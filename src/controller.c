@@ -43,6 +43,7 @@
 #include "controller.h"
 #include "gamepad.h"
 #include "touchpad.h"
+#include "savestate.h"
 
 
 void init_joypad(struct JoyPad* joyPad, uint8_t player, bool multiple_controllers_in_one_keyboard) {
@@ -50,6 +51,7 @@ void init_joypad(struct JoyPad* joyPad, uint8_t player, bool multiple_controller
     joyPad->index = 0;
     joyPad->status = 0;
     joyPad->player = player;
+    joyPad->movie_input = false;
 
     joyPad->multiple_controllers_in_one_keyboard=multiple_controllers_in_one_keyboard;
 }
@@ -71,6 +73,12 @@ void write_joypad(struct JoyPad* joyPad, uint8_t data){
         joyPad->index = 0;
 }
 
+void serialize_joypad(struct JoyPad* joyPad, struct StateStream* stream){
+    // button status follows the live input so only the serial port is saved
+    state_u8(stream, &joyPad->strobe);
+    state_u8(stream, &joyPad->index);
+}
+
 
 // Se apenas um controle for utilizado
 static uint16_t generic_keyboard_mapper(SDL_Event* event) {
@@ -190,6 +198,8 @@ void keyboard_mapper(struct JoyPad* joyPad, SDL_Event* event){
 }
 
 void update_joypad(struct JoyPad* joyPad, SDL_Event* event){
+    if(joyPad->movie_input)
+        return;
 #ifdef __ANDROID__
     ANDROID_TOUCHPAD_MAPPER(joyPad, event);
 #else
@@ -66,12 +66,17 @@ typedef struct JoyPad{
     uint16_t status;
     uint8_t player;
     bool multiple_controllers_in_one_keyboard;
+    // buttons come from a movie, live input is ignored
+    bool movie_input;
 } JoyPad;
 
+struct StateStream;
+
 
 void init_joypad(struct JoyPad* joyPad, uint8_t player, bool multiple_controllers_in_one_keyboard);
 uint8_t read_joypad(struct JoyPad* joyPad);
 void write_joypad(struct JoyPad* joyPad, uint8_t data);
+void serialize_joypad(struct JoyPad* joyPad, struct StateStream* stream);
 void update_joypad(struct JoyPad* joyPad, SDL_Event* event);
 void turbo_trigger(struct JoyPad* joyPad);
 void keyboard_mapper(struct JoyPad* joyPad, SDL_Event* event);
@@ -43,6 +43,7 @@
 #include "cpu6502.h"
 #include "emulator.h"
 #include "utils.h"
+#include "savestate.h"
 
 
 static uint16_t get_address(c6502* ctx);
@@ -71,6 +72,8 @@ void init_cpu(struct Emulator* emulator){
     cpu->ac = cpu->x = cpu->y = cpu->state = 0;
     cpu->cycles = cpu->dma_cycles = 0;
     cpu->odd_cycle = cpu->t_cycles = 0;
+    cpu->oam_dma_end = 0;
+    cpu->traces = 0;
     cpu->sr = 0x24;
     cpu->sp = 0xfd;
 #if TRACER == 1 && PROFILE == 0
@@ -86,6 +89,47 @@ void reset_cpu(c6502* cpu){
     cpu->pc = read_abs_address(cpu->memory, RESET_ADDRESS);
     cpu->cycles = 0;
     cpu->dma_cycles = 0;
+    cpu->oam_dma_end = 0;
+}
+
+uint8_t dmc_dma_stall(const c6502* ctx){
+    // cycles lost to a DMC sample fetch that starts halting the CPU on its next cycle.
+    // The halt only takes effect on a read cycle so writes in progress shorten the stall.
+    if(ctx->t_cycles < ctx->oam_dma_end){
+        // overlapping an OAM DMA
+        size_t oam_left = ctx->oam_dma_end - ctx->t_cycles;
+        if(oam_left == 2)
+            return 1;
+        if(oam_left == 1)
+            return 3;
+        return 2;
+    }
+    // cycles left in the current instruction, the next one is the opcode fetch if 0
+    uint8_t left = ctx->cycles;
+    if(left == 0)
+        return 4;
+    if(ctx->state & INTERRUPT_PENDING)
+        // 3 pushes in cycles 3 - 5 of 7
+        return left == 3 ? 3 : 4;
+
+    switch(ctx->instruction->opcode){
+        case STA: case STX: case STY: case SAX: case SHX: case SHY:
+        case PHA: case PHP:
+            return left == 1 ? 3 : 4;
+        case ASL: case LSR: case ROL: case ROR: case INC: case DEC:
+        case SLO: case SRE: case RLA: case RRA: case DCP: case ISB:
+            if(ctx->instruction->mode == ACC)
+                return 4;
+            // dummy write then the real one
+            return left == 1 ? 3 : 4;
+        case JSR:
+            // return address pushed in cycles 4 and 5 of 6
+            return left == 2 ? 3 : 4;
+        case BRK:
+            return left == 3 ? 3 : 4;
+        default:
+            return 4;
+    }
 }
 
 static void interrupt_(c6502* ctx){
@@ -100,10 +144,12 @@ static void interrupt_(c6502* ctx){
     switch (ctx->interrupt) {
         case NMI:
             addr = NMI_ADDRESS;
+            TIMELINE_INSTANT("NMI");
             break;
         case IRQ:
             addr = IRQ_ADDRESS;
             ctx->sr |= BREAK;
+            TIMELINE_INSTANT("IRQ");
             break;
         case RSI:
             addr = RESET_ADDRESS;
@@ -130,6 +176,36 @@ void interrupt(c6502* ctx, Interrupt interrupt){
 }
 
 
+void serialize_cpu(c6502* ctx, struct StateStream* stream){
+    // the decoded instruction is stored as its opcode, 0xffff if none was fetched yet
+    uint16_t opcode = ctx->instruction == NULL ? 0xffff : ctx->instruction - instructionLookup;
+    uint8_t pending = ctx->interrupt;
+    state_size(stream, &ctx->t_cycles);
+    state_u16(stream, &ctx->pc);
+    state_u16(stream, &ctx->address);
+    state_u16(stream, &ctx->dma_cycles);
+    state_size(stream, &ctx->oam_dma_end);
+    state_u8(stream, &ctx->ac);
+    state_u8(stream, &ctx->x);
+    state_u8(stream, &ctx->y);
+    state_u8(stream, &ctx->sr);
+    state_u8(stream, &ctx->sp);
+    state_u8(stream, &ctx->cycles);
+    state_u8(stream, &ctx->odd_cycle);
+    state_u8(stream, &ctx->state);
+    state_u8(stream, &pending);
+    state_u16(stream, &opcode);
+    if(!stream->loading || stream->error)
+        return;
+    if(pending > IRQ || (opcode != 0xffff && opcode > 0xff)) {
+        stream->error = 1;
+        return;
+    }
+    ctx->interrupt = pending;
+    ctx->instruction = opcode == 0xffff ? NULL : &instructionLookup[opcode];
+}
+
+
 static void branch(c6502* ctx, uint8_t mask, uint8_t predicate) {
     if(((ctx->sr & mask) > 0) == predicate){
         // increment cycles if branching to a different page
@@ -234,6 +234,7 @@ static const uint8_t cycleLookup[256] = {
 };
 
 struct Emulator;
+struct StateStream;
 
 typedef enum {
     NOI = 0,    // no interrupt
@@ -252,6 +253,8 @@ typedef struct c6502{
     uint16_t pc;
     uint16_t address;
     uint16_t dma_cycles;
+    // t_cycles value at which the last OAM DMA finishes
+    size_t oam_dma_end;
     uint8_t ac;
     uint8_t x;
     uint8_t y;
@@ -264,10 +267,14 @@ typedef struct c6502{
     Interrupt interrupt;
     const Instruction* instruction;
     Memory* memory;
+    // instructions logged by print_cpu_trace
+    uint64_t traces;
 } c6502;
 
 void init_cpu(struct Emulator* emulator);
 void reset_cpu(c6502* ctx);
+uint8_t dmc_dma_stall(const c6502* ctx);
 void execute(c6502* ctx);
 void interrupt(c6502* ctx, Interrupt interrupt);
-void print_cpu_trace(const c6502* ctx);
\ No newline at end of file
+void print_cpu_trace(c6502* ctx);
+void serialize_cpu(c6502* ctx, struct StateStream* stream);
\ No newline at end of file
@@ -63,7 +63,7 @@ void render_name_tables(struct PPU* ppu, uint32_t* screen) {
 
                 for (int x = 7; x >= 0; x--) {
                     uint8_t value = ((hi & BIT_0) << 1) | (lo & BIT_0);
-                    uint32_t color = value == 0 ? nes_palette[ppu->palette[0]] : nes_palette[*(palette + value)];
+                    uint32_t color = value == 0 ? ppu->nes_palette[ppu->palette[0]] : ppu->nes_palette[*(palette + value)];
                     hi >>= 1;
                     lo >>= 1;
                     screen[(y + tile_y * 8 + y_off) * VISIBLE_DOTS * 2 + (x + x_off + tile_x * 8)] = color;
@@ -53,9 +53,21 @@
 #include "timers.h"
 #include "debugtools.h"
 #include "utils.h"
+#include "savestate.h"
 
-static uint64_t PERIOD;
-static uint16_t TURBO_SKIP;
+
+static void run_frame(Emulator* emulator);
+static void run_frame_profiled(Emulator* emulator);
+static void run_frame_traced(Emulator* emulator);
+static uint32_t* run_ahead(Emulator* emulator);
+static void init_ahead_instance(Emulator* emulator);
+static void free_ahead_instance(Emulator* emulator);
+static void run_headless(Emulator* emulator);
+static void check_vsync(Emulator* emulator);
+static void trigger_turbo(Emulator* emulator);
+static void handle_event(Emulator* emulator, SDL_Event* e);
+static void poll_events(Emulator* emulator);
+static void skip_frame(Emulator* emulator);
 
 void init_emulator(struct Emulator* emulator, int argc, char *argv[]){
     if(argc < 2) {
@@ -70,6 +82,22 @@ void init_emulator(struct Emulator* emulator, int argc, char *argv[]){
     bool no_save=false;
     
     emulator->settings.multiple_controllers_in_one_keyboard=false;
+    emulator->settings.headless = false;
+    emulator->settings.headless_frames = 0;
+    emulator->settings.run_ahead = 0;
+    emulator->settings.run_ahead_instance = false;
+    emulator->settings.render_thread = RENDER_THREAD_SUPPORTED;
+    emulator->settings.spin_margin_us = DEFAULT_SPIN_MARGIN_US;
+    emulator->settings.pacing = PACE_TIMER;
+    emulator->settings.fast_forward = false;
+    emulator->settings.late_input = true;
+    emulator->settings.profile_file = NULL;
+    emulator->settings.trace_file = NULL;
+    emulator->settings.record_movie = NULL;
+    emulator->settings.play_movie = NULL;
+    emulator->settings.hash_log = NULL;
+    emulator->settings.perf_counters = false;
+    emulator->settings.fast_forward_speed = DEFAULT_FAST_FORWARD_SPEED;
     for (int i = 2; i < argc; i++) {
         if (strcmp(argv[i], "-genie") == 0) {
             if (i + 1 < argc) {
@@ -89,14 +117,128 @@ void init_emulator(struct Emulator* emulator, int argc, char *argv[]){
             emulator->settings.multiple_controllers_in_one_keyboard = true;
         } else if (strcmp(argv[i], "--no-save") == 0) {
             no_save = true;
+        } else if (strcmp(argv[i], "--run-ahead") == 0) {
+            if (i + 1 < argc) {
+                int frames = atoi(argv[++i]);
+                if (frames < 0 || frames > MAX_RUN_AHEAD) {
+                    LOG(ERROR, "--run-ahead expects 0 to %d frames", MAX_RUN_AHEAD);
+                    quit(EXIT_FAILURE);
+                }
+                emulator->settings.run_ahead = frames;
+            } else {
+                LOG(ERROR, "--run-ahead option requires an argument");
+                quit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--run-ahead-instance") == 0) {
+            emulator->settings.run_ahead_instance = true;
+        } else if (strcmp(argv[i], "--spin-margin") == 0) {
+            if (i + 1 < argc) {
+                emulator->settings.spin_margin_us = strtoul(argv[++i], NULL, 10);
+            } else {
+                LOG(ERROR, "--spin-margin option requires an argument");
+                quit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--pacing") == 0) {
+            const char* mode = i + 1 < argc ? argv[++i] : "";
+            if (strcmp(mode, "timer") == 0) {
+                emulator->settings.pacing = PACE_TIMER;
+            } else if (strcmp(mode, "audio") == 0) {
+                emulator->settings.pacing = PACE_AUDIO;
+            } else if (strcmp(mode, "vsync") == 0) {
+                emulator->settings.pacing = PACE_VSYNC;
+            } else {
+                LOG(ERROR, "--pacing expects timer, audio or vsync");
+                quit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--fast-forward") == 0) {
+            emulator->settings.fast_forward = true;
+        } else if (strcmp(argv[i], "--ff-speed") == 0) {
+            if (i + 1 < argc) {
+                emulator->settings.fast_forward_speed = strtoul(argv[++i], NULL, 10);
+            } else {
+                LOG(ERROR, "--ff-speed option requires an argument");
+                quit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--no-late-input") == 0) {
+            emulator->settings.late_input = false;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            if (i + 1 < argc) {
+                emulator->settings.profile_file = argv[++i];
+            } else {
+                LOG(ERROR, "--profile option requires an argument");
+                quit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--perf-counters") == 0) {
+            emulator->settings.perf_counters = true;
+        } else if (strcmp(argv[i], "--trace-events") == 0) {
+            if (i + 1 < argc) {
+                emulator->settings.trace_file = argv[++i];
+            } else {
+                LOG(ERROR, "--trace-events option requires an argument");
+                quit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--record") == 0) {
+            if (i + 1 < argc) {
+                emulator->settings.record_movie = argv[++i];
+            } else {
+                LOG(ERROR, "--record option requires an argument");
+                quit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--play") == 0) {
+            if (i + 1 < argc) {
+                emulator->settings.play_movie = argv[++i];
+            } else {
+                LOG(ERROR, "--play option requires an argument");
+                quit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--frame-hashes") == 0) {
+            if (i + 1 < argc) {
+                emulator->settings.hash_log = argv[++i];
+            } else {
+                LOG(ERROR, "--frame-hashes option requires an argument");
+                quit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--no-render-thread") == 0) {
+            emulator->settings.render_thread = false;
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            if (i + 1 < argc) {
+                emulator->settings.headless = true;
+                emulator->settings.headless_frames = strtoul(argv[++i], NULL, 10);
+                if (!emulator->settings.headless_frames) {
+                    LOG(ERROR, "--headless expects a frame count");
+                    quit(EXIT_FAILURE);
+                }
+            } else {
+                LOG(ERROR, "--headless option requires an argument");
+                quit(EXIT_FAILURE);
+            }
         } else {
             LOG(ERROR, "Unknown option: %s", argv[i]);
             quit(EXIT_FAILURE);
         }
     }    
 
+    if (emulator->settings.perf_counters && emulator->settings.profile_file == NULL) {
+        LOG(ERROR, "--perf-counters adds to the report of --profile <file>");
+        quit(EXIT_FAILURE);
+    }
+
+    uint8_t movie = emulator->settings.record_movie != NULL || emulator->settings.play_movie != NULL;
+    if (emulator->settings.record_movie != NULL && emulator->settings.play_movie != NULL) {
+        LOG(ERROR, "--record and --play can't be used together");
+        quit(EXIT_FAILURE);
+    }
+    // movies start without a battery save, and don't overwrite it either
+    if (movie)
+        save_file = NULL;
+
+    if (HEADLESS_BUILD && !emulator->settings.headless) {
+        LOG(ERROR, "This build has no window, run with --headless <frames>");
+        quit(EXIT_FAILURE);
+    }
+
     // Se o arquivo de save não for definido explicitamente
-    if (save_file == NULL && !no_save) {
+    if (save_file == NULL && !no_save && !movie) {
         // Apenas o arquivo, sem diretórios. Ex: "foo/bar.txt" => "bar.txt"
         char *basename_file_name = get_file_name(rom_file);
 
@@ -105,17 +247,25 @@ void init_emulator(struct Emulator* emulator, int argc, char *argv[]){
         snprintf(save_file, save_file_name_size, "%s.sav", basename_file_name);
     }
 
-    load_file(rom_file, genie, save_file, &emulator->mapper);
-
-    emulator->type = emulator->mapper.type;
-    emulator->mapper.emulator = emulator;
-    if(emulator->type == PAL) {
-        PERIOD = 1000000000 / PAL_FRAME_RATE;
-        TURBO_SKIP = PAL_FRAME_RATE / PAL_TURBO_RATE;
-    }else{
-        PERIOD = 1000000000 / NTSC_FRAME_RATE;
-        TURBO_SKIP = NTSC_FRAME_RATE / NTSC_TURBO_RATE;
+    if(load_file(rom_file, genie, save_file, &emulator->mapper) < 0)
+        quit(EXIT_FAILURE);
+    if(emulator->settings.headless && emulator->mapper.is_nsf) {
+        LOG(ERROR, "The NSF player needs a window, use --render-wav instead");
+        quit(EXIT_FAILURE);
+    }
+    if(emulator->mapper.is_nsf && (movie || emulator->settings.hash_log != NULL)) {
+        LOG(ERROR, "Movies and frame hashes are not supported for NSF files");
+        quit(EXIT_FAILURE);
     }
+    // the NSF player draws from the main loop and runs on the timer
+    if(emulator->mapper.is_nsf || emulator->settings.headless) {
+        emulator->settings.render_thread = false;
+        emulator->settings.pacing = PACE_TIMER;
+    }
+
+    const size_t state_file_size = strlen(get_file_name(rom_file)) + 7;
+    emulator->state_file = calloc(state_file_size, 1);
+    snprintf(emulator->state_file, state_file_size, "%s.state", get_file_name(rom_file));
 
     GraphicsContext* g_ctx = &emulator->g_ctx;
 
@@ -135,6 +285,7 @@ void init_emulator(struct Emulator* emulator, int argc, char *argv[]){
     g_ctx->width = 256;
     g_ctx->height = 240;
     g_ctx->scale = 2;
+    g_ctx->vsync = 0;
 
 #if NAMETABLE_MODE
     g_ctx->width = 512;
@@ -146,136 +297,594 @@ void init_emulator(struct Emulator* emulator, int argc, char *argv[]){
     }
     LOG(DEBUG, "RENDERING IN NAMETABLE MODE");
 #endif
-    get_graphics_context(g_ctx);
-    SDL_SetWindowTitle(g_ctx->window, get_file_name(argv[1]));
+    if(!emulator->settings.headless) {
+        get_graphics_context(g_ctx);
+        SDL_SetWindowTitle(g_ctx->window, get_file_name(argv[1]));
+        if(emulator->settings.pacing == PACE_VSYNC)
+            check_vsync(emulator);
+        // otherwise the presenter thread creates it
+        if(!emulator->settings.render_thread)
+            init_renderer(g_ctx);
+    }
+
+    init_emulator_core(emulator);
+    if(emulator->settings.record_movie != NULL
+        && start_recording(&emulator->movie, emulator->settings.record_movie, &emulator->mapper) < 0)
+        quit(EXIT_FAILURE);
+    if(emulator->settings.play_movie != NULL
+        && start_playback(&emulator->movie, emulator->settings.play_movie, &emulator->mapper) < 0)
+        quit(EXIT_FAILURE);
+    if(emulator->settings.hash_log != NULL && open_hash_log(&emulator->movie, emulator->settings.hash_log) < 0)
+        quit(EXIT_FAILURE);
+    if(emulator->settings.trace_file != NULL) {
+        start_timeline(emulator->settings.trace_file);
+        timeline_thread("emulation");
+    }
+    if(emulator->settings.profile_file != NULL) {
+        emulator->profiler = malloc(sizeof(Profiler));
+        init_profiler(emulator->profiler, emulator->settings.profile_file);
+        if(emulator->settings.perf_counters)
+            enable_perf_counters(emulator->profiler);
+    }
+    if(emulator->settings.pacing == PACE_AUDIO)
+        lock_sample_rate(&emulator->apu, emulator->type == PAL ? PAL_CPU_CLOCK : NTSC_CPU_CLOCK);
+    if(!emulator->settings.headless) {
+        ANDROID_INIT_TOUCH_PAD(g_ctx);
+        init_pads();
+    }
+
+    // nothing to rewind without input, rewinding a movie would break it
+    if(!emulator->mapper.is_nsf && !emulator->settings.headless && !movie)
+        init_rewind(&emulator->rewind, REWIND_BUDGET);
+}
+
+
+static void check_vsync(Emulator* emulator){
+    // vsync only paces correctly when the display runs at the NES frame rate,
+    // the audio sampler absorbs the small difference that is left
+    GraphicsContext* g_ctx = &emulator->g_ctx;
+    int rate = emulator->mapper.type == PAL ? PAL_FRAME_RATE : NTSC_FRAME_RATE;
+    SDL_DisplayMode mode;
+    int display = SDL_GetWindowDisplayIndex(g_ctx->window);
+    if(display < 0 || SDL_GetCurrentDisplayMode(display, &mode) < 0 || abs(mode.refresh_rate - rate) > 1) {
+        LOG(WARN, "Vsync pacing needs a %d Hz display, falling back to the timer", rate);
+        emulator->settings.pacing = PACE_TIMER;
+        return;
+    }
+    LOG(INFO, "Pacing on %d Hz vsync", mode.refresh_rate);
+    g_ctx->vsync = 1;
+    // frames have to be presented by the loop they pace
+    emulator->settings.render_thread = false;
+}
+
+
+void init_emulator_core(Emulator* emulator){
+    // everything but the window, input devices and rewind history,
+    // expects the cartridge to be loaded and the settings to be set
+    emulator->type = emulator->mapper.type;
+    emulator->mapper.emulator = emulator;
+    if(emulator->type == PAL) {
+        emulator->period = PAL_PERIOD_NUM / PAL_PERIOD_DEN;
+        emulator->turbo_skip = PAL_FRAME_RATE / PAL_TURBO_RATE;
+        init_pacer(&emulator->pacer, PAL_PERIOD_NUM, PAL_PERIOD_DEN, emulator->settings.spin_margin_us);
+    }else{
+        emulator->period = NTSC_PERIOD_NUM / NTSC_PERIOD_DEN;
+        emulator->turbo_skip = NTSC_FRAME_RATE / NTSC_TURBO_RATE;
+        init_pacer(&emulator->pacer, NTSC_PERIOD_NUM, NTSC_PERIOD_DEN, emulator->settings.spin_margin_us);
+    }
 
     init_mem(emulator);
     init_ppu(emulator);
     init_cpu(emulator);
     init_APU(emulator);
-    init_timer(&emulator->timer, PERIOD);
-    ANDROID_INIT_TOUCH_PAD(g_ctx);
-    init_pads();
+    memset(&emulator->rewind, 0, sizeof(Rewind));
+
+    emulator->ahead = NULL;
+    memset(&emulator->ahead_state, 0, sizeof(StateStream));
+    if(emulator->mapper.is_nsf || emulator->mapper.genie != NULL)
+        emulator->settings.run_ahead = 0;
+    if(emulator->settings.run_ahead) {
+        LOG(INFO, "Running %u frames ahead", emulator->settings.run_ahead);
+        init_state_stream(&emulator->ahead_state, 0);
+        emulator->ahead_state.incremental = 1;
+        if(emulator->settings.run_ahead_instance)
+            init_ahead_instance(emulator);
+    }
 
     emulator->exit = 0;
     emulator->pause = 0;
+    emulator->rewinding = 0;
+    emulator->fast_forward = 0;
+    emulator->input_pending = 0;
+    emulator->deferred_count = 0;
+    memset(&emulator->input_delay, 0, sizeof(LatencyStat));
+    memset(&emulator->input_cost, 0, sizeof(LatencyStat));
+    emulator->profiler = NULL;
+    memset(&emulator->movie, 0, sizeof(Movie));
 }
 
 
 void run_emulator(struct Emulator* emulator){
     if(emulator->mapper.is_nsf) {
+#if !HEADLESS_BUILD
         run_NSF_player(emulator);
+#endif
+        return;
+    }
+    if(emulator->settings.headless) {
+        run_headless(emulator);
         return;
     }
 
-    struct JoyPad* joy1 = &emulator->mem.joy1;
-    struct JoyPad* joy2 = &emulator->mem.joy2;
-    struct PPU* ppu = &emulator->ppu;
-    struct c6502* cpu = &emulator->cpu;
     struct APU* apu = &emulator->apu;
     struct GraphicsContext* g_ctx = &emulator->g_ctx;
-    struct Timer* timer = &emulator->timer;
-    SDL_Event e;
+    PacingMode pacing = emulator->settings.pacing;
+    // time blocked on the pacing source and age of the newest queued sample
+    LatencyStat blocked = {0}, audio_latency = {0};
+    // presents in a row that returned without waiting for vsync
+    int vsync_misses = 0;
+    uint64_t last_present = time_ns();
     Timer frame_timer;
-    init_timer(&frame_timer, PERIOD);
+    init_timer(&frame_timer, emulator->period);
     mark_start(&frame_timer);
+    if(emulator->settings.render_thread)
+        start_presenter(&emulator->presenter, g_ctx);
 
     while (!emulator->exit) {
 #if PROFILE
-        if(PROFILE_STOP_FRAME && ppu->frames >= PROFILE_STOP_FRAME)
+        if(PROFILE_STOP_FRAME && emulator->ppu.frames >= PROFILE_STOP_FRAME)
             break;
 #endif
-        mark_start(timer);
-        while (SDL_PollEvent(&e)) {
-            update_joypad(joy1, &e);
-            update_joypad(joy2, &e);
-            if((joy1->status & 0xc) == 0xc || (joy2->status & 0xc) == 0xc) {
-                reset_emulator(emulator);
-            }
-            switch (e.type) {
-                case SDL_KEYDOWN:
-                    switch (e.key.keysym.sym) {
-                        case SDLK_ESCAPE:
-                            emulator->exit = 1;
-                            break;
-                        case SDLK_AUDIOPLAY:
-                        case SDLK_SPACE:
-                            emulator->pause ^= 1;
-                            TOGGLE_TIMER_RESOLUTION();
-                            break;
-                        case SDLK_F5:
-                            reset_emulator(emulator);
-                            break;
-                        default:
-                            break;
-                    }
-                    break;
-                case SDL_QUIT:
-                    emulator->exit = 1;
-                    break;
-                default:
-                    if(e.key.keysym.sym == SDLK_AC_BACK
-                        || e.key.keysym.scancode == SDL_SCANCODE_AC_BACK) {
-                        emulator->exit = 1;
-                        LOG(DEBUG, "Exiting emulator session");
-                    }
-            }
-        }
-
-        // trigger turbo events
-        if(ppu->frames % TURBO_SKIP == 0) {
-            turbo_trigger(joy1);
-            turbo_trigger(joy2);
+        Profiler* profiler = emulator->profiler;
+        uint64_t ticks = 0;
+        TIMELINE_BEGIN("frame");
+        if(profiler != NULL) {
+            start_profile_frame(profiler);
+            ticks = profile_ticks();
         }
+        TIMELINE_BEGIN("events");
+        poll_events(emulator);
+        TIMELINE_END("events");
+        if(profiler != NULL)
+            profile_add(profiler, PROF_EVENTS, profile_ticks() - ticks);
 
         if(!emulator->pause){
-            // if ppu.render is set a frame is complete
-            if(emulator->type == NTSC) {
-                while (!ppu->render) {
-                    execute_ppu(ppu);
-                    execute_ppu(ppu);
-                    execute_ppu(ppu);
-                    execute(cpu);
-                    execute_apu(apu);
-                }
-            }else{
-                // PAL
-                uint8_t check = 0;
-                while (!ppu->render) {
-                    execute_ppu(ppu);
-                    execute_ppu(ppu);
-                    execute_ppu(ppu);
-                    check++;
-                    if(check == 5) {
-                        // on the fifth run execute an extra ppu clock
-                        // this produces 3.2 scanlines per cpu clock
-                        execute_ppu(ppu);
-                        check = 0;
-                    }
-                    execute(cpu);
-                    execute_apu(apu);
-                }
+            // input is polled again on the frame's first controller access
+            emulator->frame_start = time_ns();
+            emulator->input_pending = emulator->settings.late_input;
+            uint8_t fast_forward = (emulator->fast_forward || emulator->settings.fast_forward) && !emulator->rewinding;
+            uint16_t ff_speed = emulator->settings.fast_forward_speed;
+            TIMELINE_BEGIN("emulate");
+            if(fast_forward) {
+                // only the last frame of each shown frame is drawn and heard,
+                // uncapped runs frames until the next present is due
+                uint64_t next_present = last_present + emulator->period;
+                for(uint16_t i = 1; ff_speed ? i < ff_speed : time_ns() < next_present; i++)
+                    skip_frame(emulator);
             }
+            if(emulator->rewinding)
+                step_rewind(&emulator->rewind, emulator);
+            else
+                record_rewind(&emulator->rewind, emulator);
+
+            uint32_t* screen = step_frame(emulator);
+            emulator->input_pending = 0;
+            TIMELINE_END("emulate");
 #if NAMETABLE_MODE
-            render_name_tables(ppu, ppu->screen);
+            render_name_tables(&emulator->ppu, screen);
 #endif
-            render_graphics(g_ctx, ppu->screen);
-            ppu->render = 0;
+            uint64_t present_start = time_ns();
+            if(profiler != NULL)
+                ticks = profile_ticks();
+            TIMELINE_BEGIN("present");
+            if(emulator->settings.render_thread)
+                publish_frame(&emulator->presenter, screen);
+            else
+                render_graphics(g_ctx, screen);
+            TIMELINE_END("present");
+            if(profiler != NULL)
+                profile_add(profiler, PROF_PRESENT, profile_ticks() - ticks);
+            last_present = time_ns();
+            if(pacing == PACE_VSYNC && !fast_forward) {
+                uint64_t present_time = last_present - present_start;
+                add_latency(&blocked, present_time);
+                // the driver may ignore the vsync request, don't run unpaced then
+                vsync_misses = present_time < VSYNC_MIN_WAIT_NS ? vsync_misses + 1 : 0;
+                if(vsync_misses > VSYNC_MAX_MISSES) {
+                    LOG(WARN, "Present does not wait for vsync, falling back to the timer");
+                    pacing = PACE_TIMER;
+                }
+            }
+            if(profiler != NULL)
+                ticks = profile_ticks();
+            TIMELINE_BEGIN("audio queue");
             queue_audio(apu, g_ctx);
-            mark_end(timer);
-            adjusted_wait(timer);
+            TIMELINE_END("audio queue");
+            if(profiler != NULL)
+                profile_add(profiler, PROF_AUDIO_QUEUE, profile_ticks() - ticks);
+            uint64_t queued = SDL_GetQueuedAudioSize(g_ctx->audio_device);
+            add_latency(&audio_latency, queued * 1000000000 / (SAMPLING_FREQUENCY * sizeof(int16_t)));
+            if(profiler != NULL)
+                ticks = profile_ticks();
+            // uncapped fast-forward does not wait
+            TIMELINE_BEGIN("sleep");
+            if(pacing == PACE_AUDIO && (!fast_forward || ff_speed))
+                add_latency(&blocked, wait_for_audio(apu, g_ctx));
+            else if(pacing == PACE_TIMER && (!fast_forward || ff_speed))
+                pace_frame(&emulator->pacer);
+            TIMELINE_END("sleep");
+            if(profiler != NULL) {
+                profile_add(profiler, PROF_PACING, profile_ticks() - ticks);
+                end_profile_frame(profiler);
+            }
         }else{
             wait(IDLE_SLEEP);
         }
+        TIMELINE_END("frame");
     }
 
+    if(emulator->settings.render_thread)
+        stop_presenter(&emulator->presenter);
+    if(pacing == PACE_TIMER)
+        report_pacer(&emulator->pacer);
+    else if(pacing == PACE_AUDIO)
+        report_latency(&blocked, "Audio clock wait per frame");
+    else
+        report_latency(&blocked, "Present wait for vsync");
+    report_latency(&audio_latency, "Audio queue latency");
+    if(emulator->input_cost.count) {
+        LOG(INFO, "Late input poll: %.2f ms into the frame avg, %.1f us avg, %.1f us max per poll",
+            (double)emulator->input_delay.total_ns / emulator->input_delay.count / 1e6,
+            (double)emulator->input_cost.total_ns / emulator->input_cost.count / 1e3,
+            (double)emulator->input_cost.max_ns / 1e3);
+    }
+    mark_end(&frame_timer);
+    emulator->time_diff = get_diff_ms(&frame_timer);
+    release_timer(&frame_timer);
+}
+
+uint32_t* step_frame(Emulator* emulator){
+    movie_frame_start(emulator);
+    trigger_turbo(emulator);
+    // the frame's samples are in apu.buff[0, apu.sampler.index) on return
+    emulator->apu.sampler.index = 0;
+    uint32_t* screen = emulator->ppu.screen;
+    if(emulator->settings.run_ahead)
+        screen = run_ahead(emulator);
+    else
+        run_frame(emulator);
+    movie_frame_end(emulator, screen);
+    return screen;
+}
+
+
+static void handle_event(Emulator* emulator, SDL_Event* e){
+    // a movie replays its own resets
+    uint8_t playing = emulator->movie.mode == MOVIE_PLAY;
+    if(!playing && ((emulator->mem.joy1.status & 0xc) == 0xc || (emulator->mem.joy2.status & 0xc) == 0xc)) {
+        reset_emulator(emulator);
+    }
+    switch (e->type) {
+        case SDL_KEYDOWN:
+            switch (e->key.keysym.sym) {
+                case SDLK_ESCAPE:
+                    emulator->exit = 1;
+                    break;
+                case SDLK_AUDIOPLAY:
+                case SDLK_SPACE:
+                    emulator->pause ^= 1;
+                    TOGGLE_TIMER_RESOLUTION();
+                    break;
+                case SDLK_F5:
+                    if(!playing)
+                        reset_emulator(emulator);
+                    break;
+                case SDLK_F2:
+                    save_state_file(emulator, emulator->state_file);
+                    break;
+                case SDLK_F3:
+                    if(emulator->movie.mode == MOVIE_RECORD || playing)
+                        LOG(WARN, "States can't be loaded during a movie");
+                    else
+                        load_state_file(emulator, emulator->state_file);
+                    break;
+                case SDLK_BACKSPACE:
+                    emulator->rewinding = 1;
+                    break;
+                case FAST_FORWARD_KEY:
+                    emulator->fast_forward = 1;
+                    break;
+                default:
+                    break;
+            }
+            break;
+        case SDL_QUIT:
+            emulator->exit = 1;
+            break;
+        case SDL_KEYUP:
+            if(e->key.keysym.sym == SDLK_BACKSPACE)
+                emulator->rewinding = 0;
+            else if(e->key.keysym.sym == FAST_FORWARD_KEY)
+                emulator->fast_forward = 0;
+            // fall through
+        default:
+            if(e->key.keysym.sym == SDLK_AC_BACK
+                || e->key.keysym.scancode == SDL_SCANCODE_AC_BACK) {
+                emulator->exit = 1;
+                LOG(DEBUG, "Exiting emulator session");
+            }
+    }
+}
+
+
+static void poll_events(Emulator* emulator){
+    // events taken by a late poll already reached the controllers
+    for(uint8_t i = 0; i < emulator->deferred_count; i++)
+        handle_event(emulator, &emulator->deferred_events[i]);
+    emulator->deferred_count = 0;
+    SDL_Event e;
+    while (SDL_PollEvent(&e)) {
+        update_joypad(&emulator->mem.joy1, &e);
+        update_joypad(&emulator->mem.joy2, &e);
+        handle_event(emulator, &e);
+    }
+}
+
+
+void poll_input_late(Emulator* emulator){
+    // runs inside the frame, so everything other than the controller update
+    // waits for the next frame start
+    uint64_t start = time_ns(), ticks = profile_ticks();
+    emulator->input_pending = 0;
+    while (emulator->deferred_count < MAX_DEFERRED_EVENTS) {
+        SDL_Event* e = &emulator->deferred_events[emulator->deferred_count];
+        if(!SDL_PollEvent(e))
+            break;
+        update_joypad(&emulator->mem.joy1, e);
+        update_joypad(&emulator->mem.joy2, e);
+        emulator->deferred_count++;
+    }
+    uint64_t end = time_ns();
+    add_latency(&emulator->input_delay, start - emulator->frame_start);
+    add_latency(&emulator->input_cost, end - start);
+    if(emulator->profiler != NULL)
+        profile_add(emulator->profiler, PROF_EVENTS, profile_ticks() - ticks);
+}
+
+
+static void trigger_turbo(Emulator* emulator){
+    if(emulator->ppu.frames % emulator->turbo_skip == 0) {
+        turbo_trigger(&emulator->mem.joy1);
+        turbo_trigger(&emulator->mem.joy2);
+    }
+}
+
+
+static void skip_frame(Emulator* emulator){
+    // timing only frame: pixels are composed only where they can set sprite
+    // zero hit and no samples are taken, run-ahead has nothing to hide here
+    uint8_t no_render = emulator->ppu.no_render, no_audio = emulator->apu.no_audio;
+    emulator->ppu.no_render = 1;
+    emulator->apu.no_audio = 1;
+    movie_frame_start(emulator);
+    trigger_turbo(emulator);
+    run_frame(emulator);
+    movie_frame_end(emulator, NULL);
+    emulator->ppu.no_render = no_render;
+    emulator->apu.no_audio = no_audio;
+}
+
+
+static void run_headless(Emulator* emulator){
+    // runs unpaced, there is no display to keep up with
+    uint32_t frames = emulator->settings.headless_frames;
+    Timer frame_timer;
+    init_timer(&frame_timer, emulator->period);
+    mark_start(&frame_timer);
+    for(uint32_t i = 0; !emulator->exit && i < frames; i++) {
+        // a played movie ends the session with it
+        if(emulator->movie.mode == MOVIE_ENDED)
+            break;
+        if(emulator->profiler != NULL)
+            start_profile_frame(emulator->profiler);
+        TIMELINE_BEGIN("frame");
+        step_frame(emulator);
+        TIMELINE_END("frame");
+        if(emulator->profiler != NULL)
+            end_profile_frame(emulator->profiler);
+    }
     mark_end(&frame_timer);
     emulator->time_diff = get_diff_ms(&frame_timer);
     release_timer(&frame_timer);
 }
 
+
+static void run_frame(Emulator* emulator){
+    if(emulator->profiler != NULL) {
+        run_frame_profiled(emulator);
+        return;
+    }
+    if(timeline_enabled) {
+        run_frame_traced(emulator);
+        return;
+    }
+    PPU* ppu = &emulator->ppu;
+    c6502* cpu = &emulator->cpu;
+    APU* apu = &emulator->apu;
+    // if ppu.render is set a frame is complete
+    if(emulator->type == NTSC) {
+        while (!ppu->render) {
+            execute_ppu(ppu);
+            execute_ppu(ppu);
+            execute_ppu(ppu);
+            execute(cpu);
+            execute_apu(apu);
+        }
+    }else{
+        // PAL
+        uint8_t check = 0;
+        while (!ppu->render) {
+            execute_ppu(ppu);
+            execute_ppu(ppu);
+            execute_ppu(ppu);
+            check++;
+            if(check == 5) {
+                // on the fifth run execute an extra ppu clock
+                // this produces 3.2 scanlines per cpu clock
+                execute_ppu(ppu);
+                check = 0;
+            }
+            execute(cpu);
+            execute_apu(apu);
+        }
+    }
+    ppu->render = 0;
+}
+
+
+static void run_frame_profiled(Emulator* emulator){
+    // same as run_frame but times the steps of every PROFILE_SAMPLE_PERIOD
+    // cycle. The frame is timed as a whole and split by the sampled shares,
+    // scaling the samples up would scale the cost of reading the clock too
+    PPU* ppu = &emulator->ppu;
+    c6502* cpu = &emulator->cpu;
+    APU* apu = &emulator->apu;
+    uint64_t sampled[3] = {0};
+    uint8_t check = 0;
+    uint32_t cycle = 0;
+    uint64_t perf_start[PERF_COUNTERS];
+    if(emulator->profiler->use_perf)
+        perf_begin(emulator->profiler, perf_start);
+    uint64_t frame_start = profile_ticks();
+    while (!ppu->render) {
+        uint8_t ppu_clocks = 3;
+        // PAL runs an extra ppu clock every fifth cpu clock
+        if(emulator->type != NTSC && ++check == 5) {
+            ppu_clocks = 4;
+            check = 0;
+        }
+        if(++cycle % PROFILE_SAMPLE_PERIOD) {
+            for(uint8_t i = 0; i < ppu_clocks; i++)
+                execute_ppu(ppu);
+            execute(cpu);
+            execute_apu(apu);
+            continue;
+        }
+        uint64_t start = profile_ticks();
+        for(uint8_t i = 0; i < ppu_clocks; i++)
+            execute_ppu(ppu);
+        uint64_t ppu_end = profile_ticks();
+        execute(cpu);
+        uint64_t cpu_end = profile_ticks();
+        execute_apu(apu);
+        sampled[0] += profile_interval(emulator->profiler, start, ppu_end);
+        sampled[1] += profile_interval(emulator->profiler, ppu_end, cpu_end);
+        sampled[2] += profile_interval(emulator->profiler, cpu_end, profile_ticks());
+    }
+    ppu->render = 0;
+    uint64_t total = profile_ticks() - frame_start;
+    if(emulator->profiler->use_perf)
+        perf_end(emulator->profiler, PERF_SCOPE_EMULATION, perf_start);
+    uint64_t sum = sampled[0] + sampled[1] + sampled[2];
+    if(sum) {
+        profile_add(emulator->profiler, PROF_PPU, total * sampled[0] / sum);
+        profile_add(emulator->profiler, PROF_CPU, total * sampled[1] / sum);
+        profile_add(emulator->profiler, PROF_APU, total * sampled[2] / sum);
+    }
+}
+
+
+static void run_frame_traced(Emulator* emulator){
+    // same as run_frame with a span per batch of scanlines
+    PPU* ppu = &emulator->ppu;
+    c6502* cpu = &emulator->cpu;
+    APU* apu = &emulator->apu;
+    uint8_t check = 0;
+    int batch = ppu->scanlines / TIMELINE_SCANLINE_BATCH;
+    TIMELINE_BEGIN("scanlines");
+    while (!ppu->render) {
+        execute_ppu(ppu);
+        execute_ppu(ppu);
+        execute_ppu(ppu);
+        // PAL runs an extra ppu clock every fifth cpu clock
+        if(emulator->type != NTSC && ++check == 5) {
+            execute_ppu(ppu);
+            check = 0;
+        }
+        execute(cpu);
+        execute_apu(apu);
+        if(ppu->scanlines / TIMELINE_SCANLINE_BATCH != batch) {
+            batch = ppu->scanlines / TIMELINE_SCANLINE_BATCH;
+            TIMELINE_END("scanlines");
+            TIMELINE_BEGIN("scanlines");
+        }
+    }
+    TIMELINE_END("scanlines");
+    ppu->render = 0;
+}
+
+
+static uint32_t* run_ahead(Emulator* emulator){
+    // the real frame keeps its audio but is never shown
+    emulator->ppu.no_render = 1;
+    run_frame(emulator);
+    if(save_state(emulator, &emulator->ahead_state) < 0) {
+        emulator->settings.run_ahead = 0;
+        emulator->ppu.no_render = 0;
+        return emulator->ppu.screen;
+    }
+
+    Emulator* target = emulator;
+    if(emulator->ahead != NULL) {
+        target = emulator->ahead;
+        target->mem.joy1.status = emulator->mem.joy1.status;
+        target->mem.joy2.status = emulator->mem.joy2.status;
+        load_state(target, &emulator->ahead_state);
+    }
+
+    // speculative frames only need the last picture
+    target->apu.no_audio = 1;
+    for(uint8_t i = 1; i < emulator->settings.run_ahead; i++)
+        run_frame(target);
+    target->ppu.no_render = 0;
+    run_frame(target);
+
+    if(target == emulator) {
+        emulator->apu.no_audio = 0;
+        load_state(emulator, &emulator->ahead_state);
+    }
+    return target->ppu.screen;
+}
+
+
+static void init_ahead_instance(Emulator* emulator){
+    // shares ROM with the real emulator and has no window or audio device
+    Emulator* ahead = calloc(1, sizeof(Emulator));
+    ahead->settings = emulator->settings;
+    ahead->settings.headless = true;
+    ahead->settings.run_ahead = 0;
+    clone_mapper(&ahead->mapper, &emulator->mapper);
+    init_emulator_core(ahead);
+    ahead->apu.no_audio = 1;
+    emulator->ahead = ahead;
+    // the real instance is never shown
+    emulator->ppu.no_render = 1;
+}
+
+
+static void free_ahead_instance(Emulator* emulator){
+    if(emulator->ahead == NULL)
+        return;
+    exit_ppu(&emulator->ahead->ppu);
+    free_mapper(&emulator->ahead->mapper);
+    free(emulator->ahead);
+    emulator->ahead = NULL;
+}
+
+
 void reset_emulator(Emulator* emulator) {
     LOG(INFO, "Resetting emulator");
+    movie_event(&emulator->movie, MOVIE_RESET);
     reset_cpu(&emulator->cpu);
     reset_APU(&emulator->apu);
     reset_ppu(&emulator->ppu);
@@ -284,6 +893,7 @@ void reset_emulator(Emulator* emulator) {
     }
 }
 
+#if !HEADLESS_BUILD
 void run_NSF_player(struct Emulator* emulator) {
     LOG(INFO, "Starting NSF player...");
     JoyPad* joy1 = &emulator->mem.joy1;
@@ -293,12 +903,12 @@ void run_NSF_player(struct Emulator* emulator) {
     NSF* nsf = emulator->mapper.NSF;
     GraphicsContext* g_ctx = &emulator->g_ctx;
     init_NSF_gfx(g_ctx, nsf);
-    Timer* timer = &emulator->timer;
     SDL_Event e;
     Timer frame_timer;
-    PERIOD = 1000 * emulator->mapper.NSF->speed;
+    emulator->period = 1000 * emulator->mapper.NSF->speed;
+    init_pacer(&emulator->pacer, emulator->period, 1, emulator->settings.spin_margin_us);
     double ms_per_frame = emulator->mapper.NSF->speed / 1000.0;
-    init_timer(&frame_timer, PERIOD);
+    init_timer(&frame_timer, emulator->period);
     mark_start(&frame_timer);
     size_t cycles_per_frame;
     if(emulator->type == PAL) {
@@ -312,7 +922,6 @@ void run_NSF_player(struct Emulator* emulator) {
     init_song(emulator, nsf->current_song);
 
     while (!emulator->exit) {
-        mark_start(timer);
         while (SDL_PollEvent(&e)) {
             update_joypad(joy1, &e);
             update_joypad(joy2, &e);
@@ -369,19 +978,8 @@ void run_NSF_player(struct Emulator* emulator) {
             }
         }
 
-        if(nsf->times != NULL && !nsf->initializing) {
-            double track_dur = nsf->times[nsf->current_song == 0 ? 0 : nsf->current_song - 1];
-            if(track_dur < nsf->tick) {
-                if(nsf->tick_max < nsf->tick) {
-                    next_song(emulator, nsf);
-                } else if(nsf->fade != NULL) {
-                    // fade
-                    int fade_dur = nsf->fade[nsf->current_song == 0 ? 0 : nsf->current_song - 1];
-                    apu->volume = (nsf->tick - track_dur) / (float)fade_dur;
-                    // clamp to range (0,1) then invert
-                    apu->volume = 1 - (apu->volume < 0 ? 0 : apu->volume > 1 ? 1 : apu->volume);
-                }
-            }
+        if(update_NSF_fade(nsf, apu)) {
+            next_song(emulator, nsf);
         }
 
         if(cpu->pc == NSF_SENTINEL_ADDR) {
@@ -389,15 +987,7 @@ void run_NSF_player(struct Emulator* emulator) {
         }
 
         if(!emulator->pause){
-            size_t cycles = 0;
-            while (cycles < cycles_per_frame) {
-                // run CPU if RTS has not been called
-                if(cpu->pc != NSF_SENTINEL_ADDR)
-                    execute(cpu);
-                if(!nsf->initializing)
-                    execute_apu(apu);
-                cycles++;
-            }
+            run_NSF_cycles(emulator, nsf, cycles_per_frame);
 
             render_NSF_graphics(emulator, nsf);
             if(!nsf->initializing) {
@@ -408,26 +998,39 @@ void run_NSF_player(struct Emulator* emulator) {
                 nsf->initializing = 0;
                 nsf->tick = 0;
             }
-            mark_end(timer);
-            adjusted_wait(timer);
+            pace_frame(&emulator->pacer);
         }else{
             wait(IDLE_SLEEP);
         }
     }
 
+    report_pacer(&emulator->pacer);
     mark_end(&frame_timer);
     emulator->time_diff = get_diff_ms(&frame_timer);
     release_timer(&frame_timer);
 }
+#endif
 
 
 void free_emulator(struct Emulator* emulator){
     LOG(DEBUG, "Starting emulator clean up");
-    exit_APU();
+    exit_APU(&emulator->apu);
     exit_ppu(&emulator->ppu);
     free_mapper(&emulator->mapper);
-    ANDROID_FREE_TOUCH_PAD();
-    free_graphics(&emulator->g_ctx);
-    release_timer(&emulator->timer);
+    if(!emulator->settings.headless) {
+        ANDROID_FREE_TOUCH_PAD();
+        free_graphics(&emulator->g_ctx);
+    }
+    free(emulator->state_file);
+    free_rewind(&emulator->rewind);
+    free_ahead_instance(emulator);
+    free_state_stream(&emulator->ahead_state);
+    stop_movie(&emulator->movie);
+    if(emulator->profiler != NULL) {
+        write_profile(emulator->profiler);
+        free_profiler(emulator->profiler);
+        free(emulator->profiler);
+    }
+    stop_timeline();
     LOG(DEBUG, "Emulator session successfully terminated");
 }
\ No newline at end of file
@@ -49,6 +49,11 @@
 #include "mapper.h"
 #include "gfx.h"
 #include "timers.h"
+#include "rewind.h"
+#include "presenter.h"
+#include "profiler.h"
+#include "timeline.h"
+#include "movie.h"
 
 #include "settings.h"
 
@@ -56,6 +61,13 @@
 // frame rate in Hz
 #define NTSC_FRAME_RATE 60
 #define PAL_FRAME_RATE 50
+// exact frame periods in ns as fractions, CPU cycles per frame over the
+// CPU clock: 29780.5 / 1789772.73 Hz (60.0988 Hz) and 33247.5 / 1662607 Hz
+// (50.0070 Hz)
+#define NTSC_PERIOD_NUM 5241368000ULL
+#define NTSC_PERIOD_DEN 315
+#define PAL_PERIOD_NUM 42556800000000ULL
+#define PAL_PERIOD_DEN 2128137
 
 // turbo keys toggle rate (Hz)
 // value should be a factor of FRAME_RATE
@@ -66,6 +78,20 @@
 // sleep time when emulator is paused in milliseconds
 #define IDLE_SLEEP 50
 
+// upper limit for --run-ahead
+#define MAX_RUN_AHEAD 4
+
+// --pacing vsync gives up after this many presents in a row return sooner
+#define VSYNC_MIN_WAIT_NS 500000
+#define VSYNC_MAX_MISSES 30
+
+// emulated frames per shown frame while fast-forwarding, 0 is uncapped
+#define DEFAULT_FAST_FORWARD_SPEED 4
+#define FAST_FORWARD_KEY SDLK_BACKQUOTE
+
+// events a late input poll can hold until the next frame start
+#define MAX_DEFERRED_EVENTS 64
+
 
 typedef struct Emulator{
     c6502 cpu;
@@ -74,21 +100,52 @@ typedef struct Emulator{
     Memory mem;
     Mapper mapper;
     GraphicsContext g_ctx;
-    Timer timer;
+    Presenter presenter;
+    Pacer pacer;
 
     TVSystem type;
+    // frame period in ns and frames between turbo toggles
+    uint64_t period;
+    uint16_t turbo_skip;
 
     double time_diff;
+    // quick save state slot
+    char* state_file;
+    Rewind rewind;
+    // run-ahead snapshot and optional second instance
+    StateStream ahead_state;
+    struct Emulator* ahead;
 
     uint8_t exit;
     uint8_t pause;
+    uint8_t rewinding;
+    // fast-forward key held
+    uint8_t fast_forward;
+    // set at frame start, the first controller access in the frame polls input
+    uint8_t input_pending;
+    uint64_t frame_start;
+    // events taken by the late poll, handled at the next frame start
+    SDL_Event deferred_events[MAX_DEFERRED_EVENTS];
+    uint8_t deferred_count;
+    // when in the frame the late poll ran and how long it took
+    LatencyStat input_delay;
+    LatencyStat input_cost;
+    // set by --profile
+    Profiler* profiler;
+    // input movie and frame hash log
+    Movie movie;
 
     EmulatorSettings settings;
 } Emulator;
 
 
 void init_emulator(Emulator* emulator, int argc, char *argv[]);
+void init_emulator_core(Emulator* emulator);
 void reset_emulator(Emulator* emulator);
 void run_emulator(Emulator* emulator);
+uint32_t* step_frame(Emulator* emulator);
+void poll_input_late(Emulator* emulator);
+#if !HEADLESS_BUILD
 void run_NSF_player(Emulator* emulator);
+#endif
 void free_emulator(Emulator* emulator);
@@ -59,7 +59,8 @@ static void swap_mirroring(Genie* genie);
 
 void load_genie(char* filename, Mapper* mapper){
     Genie* genie = calloc(1, sizeof(Genie));
-    load_file(filename, NULL, NULL, &genie->g_mapper);
+    if(load_file(filename, NULL, NULL, &genie->g_mapper) < 0)
+        quit(EXIT_FAILURE);
     mapper->genie = genie;
     genie->mapper = mapper;
 
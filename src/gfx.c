@@ -44,7 +44,9 @@
 
 #include "gfx.h"
 #include "utils.h"
+#if !HEADLESS_BUILD
 #include "font.h"
+#endif
 
 #ifdef __ANDROID__
 #include "touchpad.h"
@@ -53,7 +55,9 @@
 void get_graphics_context(GraphicsContext* ctx){
 
     SDL_Init(SDL_INIT_EVERYTHING);
+#if !HEADLESS_BUILD
     TTF_Init();
+#endif
 #ifdef __ANDROID__
     ctx->font = TTF_OpenFont("asap.ttf", (int)(ctx->screen_height * 0.05));
     if(ctx->font == NULL){
@@ -71,11 +75,13 @@ void get_graphics_context(GraphicsContext* ctx){
         | SDL_WINDOW_ALLOW_HIGHDPI
     );
 #else
+#if !HEADLESS_BUILD
     SDL_RWops* rw = SDL_RWFromMem(font_data, sizeof(font_data));
     ctx->font = TTF_OpenFontRW(rw, 1, 11);
     if(ctx->font == NULL){
         LOG(ERROR, SDL_GetError());
     }
+#endif
     ctx->window = SDL_CreateWindow(
         "NES Emulator",
         SDL_WINDOWPOS_CENTERED,
@@ -94,8 +100,14 @@ void get_graphics_context(GraphicsContext* ctx){
         quit(EXIT_FAILURE);
     }
     SDL_SetWindowMinimumSize(ctx->window, ctx->width, ctx->height);
+    LOG(DEBUG, "Initialized SDL subsystem");
+}
 
-    ctx->renderer = SDL_CreateRenderer(ctx->window, -1, SDL_RENDERER_ACCELERATED);
+void init_renderer(GraphicsContext* ctx){
+    Uint32 flags = SDL_RENDERER_ACCELERATED;
+    if(ctx->vsync)
+        flags |= SDL_RENDERER_PRESENTVSYNC;
+    ctx->renderer = SDL_CreateRenderer(ctx->window, -1, flags);
     if(ctx->renderer == NULL){
         LOG(ERROR, SDL_GetError());
         quit(EXIT_FAILURE);
@@ -128,8 +140,13 @@ void get_graphics_context(GraphicsContext* ctx){
     SDL_SetRenderDrawColor(ctx->renderer, 0, 0, 0, 255);
     SDL_RenderClear(ctx->renderer);
     SDL_RenderPresent(ctx->renderer);
+}
 
-    LOG(DEBUG, "Initialized SDL subsystem");
+void free_renderer(GraphicsContext* ctx){
+    SDL_DestroyTexture(ctx->texture);
+    SDL_DestroyRenderer(ctx->renderer);
+    ctx->texture = NULL;
+    ctx->renderer = NULL;
 }
 
 void render_graphics(GraphicsContext* g_ctx, const uint32_t* buffer){
@@ -146,10 +163,12 @@ void render_graphics(GraphicsContext* g_ctx, const uint32_t* buffer){
 }
 
 void free_graphics(GraphicsContext* ctx){
+#if !HEADLESS_BUILD
     TTF_CloseFont(ctx->font);
     TTF_Quit();
-    SDL_DestroyTexture(ctx->texture);
-    SDL_DestroyRenderer(ctx->renderer);
+#endif
+    if(ctx->renderer != NULL)
+        free_renderer(ctx);
     SDL_DestroyWindow(ctx->window);
     SDL_CloseAudioDevice(ctx->audio_device);
     SDL_Quit();
@@ -43,7 +43,14 @@
 #pragma once
 
 #include <SDL2/SDL.h>
+
+#include "utils.h"
+
+#if HEADLESS_BUILD
+typedef struct _TTF_Font TTF_Font;
+#else
 #include <SDL2/SDL_ttf.h>
+#endif
 
 typedef struct GraphicsContext{
     SDL_Window* window;
@@ -57,11 +64,16 @@ typedef struct GraphicsContext{
     int screen_width;
     int screen_height;
     float scale;
+    // present waits for the display's vertical blank
+    uint8_t vsync;
 
 } GraphicsContext;
 
 void free_graphics(GraphicsContext* ctx);
 
 void get_graphics_context(GraphicsContext* ctx);
+// the renderer and texture belong to the thread that creates them
+void init_renderer(GraphicsContext* ctx);
+void free_renderer(GraphicsContext* ctx);
 
 void render_graphics(GraphicsContext* g_ctx, const uint32_t* buffer);
\ No newline at end of file
@@ -0,0 +1,118 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libnes.h"
+#include "emulator.h"
+#include "savestate.h"
+#include "utils.h"
+
+struct NES {
+    Emulator emulator;
+    // reused by nes_save_state
+    StateStream state;
+};
+
+
+NES* nes_create(const uint8_t* rom, size_t size){
+    NES* nes = calloc(1, sizeof(NES));
+    if(nes == NULL)
+        return NULL;
+    Emulator* emulator = &nes->emulator;
+    emulator->settings.headless = true;
+    if(load_ROM_image(rom, size, &emulator->mapper) < 0) {
+        free(nes);
+        return NULL;
+    }
+    init_emulator_core(emulator);
+    init_state_stream(&nes->state, 0);
+    return nes;
+}
+
+
+void nes_destroy(NES* nes){
+    if(nes == NULL)
+        return;
+    free_emulator(&nes->emulator);
+    free_state_stream(&nes->state);
+    free(nes);
+}
+
+
+void nes_reset(NES* nes){
+    reset_emulator(&nes->emulator);
+}
+
+
+void nes_set_input(NES* nes, int port, uint16_t buttons){
+    JoyPad* joy = port ? &nes->emulator.mem.joy2 : &nes->emulator.mem.joy1;
+    // turbo bits are frontend state, keep them out
+    joy->status = buttons & 0xff;
+}
+
+
+const uint32_t* nes_step_frame(NES* nes){
+    return step_frame(&nes->emulator);
+}
+
+
+const uint32_t* nes_frame_buffer(const NES* nes){
+    return nes->emulator.ppu.screen;
+}
+
+
+size_t nes_audio_samples(const NES* nes, const int16_t** samples){
+    *samples = nes->emulator.apu.buff;
+    return nes->emulator.apu.sampler.index;
+}
+
+
+int nes_set_grey_output(NES* nes, int width, int height){
+    if(width < 0 || height < 0)
+        return -1;
+    return set_grey_output(&nes->emulator.ppu, width, height);
+}
+
+
+const uint8_t* nes_grey_frame(const NES* nes){
+    const GreyOutput* grey = nes->emulator.ppu.grey;
+    return grey != NULL ? grey->pixels : NULL;
+}
+
+
+size_t nes_save_state(NES* nes, const uint8_t** data){
+    if(save_state(&nes->emulator, &nes->state) < 0)
+        return 0;
+    *data = nes->state.data;
+    return nes->state.size;
+}
+
+
+int nes_load_state(NES* nes, const uint8_t* data, size_t size){
+    // load_state only reads, wrap the caller's buffer without copying
+    StateStream stream;
+    memset(&stream, 0, sizeof(StateStream));
+    stream.data = (uint8_t*)data;
+    stream.size = stream.capacity = size;
+    return load_state(&nes->emulator, &stream);
+}
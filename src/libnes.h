@@ -0,0 +1,108 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Embedding API. Everything an in-process client needs to drive the
+// emulator: no window, audio device or pacing is involved.
+
+#define NES_WIDTH 256
+#define NES_HEIGHT 240
+#define NES_SAMPLE_RATE 48000
+
+// controller bits, same layout as the $4016/$4017 shift register
+enum {
+    NES_BUTTON_A      = 1,
+    NES_BUTTON_B      = 1 << 1,
+    NES_BUTTON_SELECT = 1 << 2,
+    NES_BUTTON_START  = 1 << 3,
+    NES_BUTTON_UP     = 1 << 4,
+    NES_BUTTON_DOWN   = 1 << 5,
+    NES_BUTTON_LEFT   = 1 << 6,
+    NES_BUTTON_RIGHT  = 1 << 7,
+};
+
+typedef struct NES NES;
+
+// returns NULL if the buffer is not an iNES/NES 2.0 image or the cartridge
+// is not supported
+NES* nes_create(const uint8_t* rom, size_t size);
+void nes_destroy(NES* nes);
+void nes_reset(NES* nes);
+
+// port 0 or 1, a mask of NES_BUTTON_* held for the next frames
+void nes_set_input(NES* nes, int port, uint16_t buttons);
+// runs until the next frame is complete and returns it
+const uint32_t* nes_step_frame(NES* nes);
+// NES_WIDTH x NES_HEIGHT pixels, R G B A bytes in memory
+const uint32_t* nes_frame_buffer(const NES* nes);
+// mono samples at NES_SAMPLE_RATE produced by the last nes_step_frame
+size_t nes_audio_samples(const NES* nes, const int16_t** samples);
+// draw width x height 8 bit luminance frames (e.g. 84x84) instead of the
+// colour frame buffer, 0 switches back. Returns -1 for sizes over 256x240
+int nes_set_grey_output(NES* nes, int width, int height);
+// the last grey frame, NULL while grey output is off
+const uint8_t* nes_grey_frame(const NES* nes);
+
+// returns the state size or 0 on failure, the data stays valid
+// until the next call on this instance
+size_t nes_save_state(NES* nes, const uint8_t** data);
+int nes_load_state(NES* nes, const uint8_t* data, size_t size);
+
+
+// Batched environments for reinforcement learning. count instances of one
+// ROM are stepped together, split over worker threads.
+
+typedef struct NESVecEnv NESVecEnv;
+
+typedef struct NESVecConfig {
+    // frames run with the same input per step, 0 counts as 1
+    int frame_skip;
+    // observe the per channel max of the last two frames of a step
+    int max_pool;
+    // an instance is done once (RAM[done_addr] & done_mask) == done_value,
+    // never while done_mask is 0. done_addr is a CPU RAM address < 0x800
+    uint16_t done_addr;
+    uint8_t done_mask;
+    uint8_t done_value;
+    // threads stepping instances including the caller's, 0 for one per core
+    int threads;
+    // observe grey_width x grey_height luminance bytes instead of colour
+    // frames when both are set
+    int grey_width;
+    int grey_height;
+} NESVecConfig;
+
+// config may be NULL for no frame skip, pooling or done condition
+NESVecEnv* nes_vec_create(const uint8_t* rom, size_t size, int count, const NESVecConfig* config);
+void nes_vec_destroy(NESVecEnv* env);
+// puts every instance back to its power on state
+void nes_vec_reset(NESVecEnv* env);
+// inputs holds the player 1 NES_BUTTON_* mask of each instance, obs receives
+// count frames back to back, NES_WIDTH x NES_HEIGHT pixels or the grey size
+// in bytes, and dones, if not NULL, count flags. A done instance starts over
+// on the next step
+void nes_vec_step(NESVecEnv* env, const uint16_t* inputs, void* obs, uint8_t* dones);
+// the 2KB of CPU RAM of instance index, for rewards
+const uint8_t* nes_vec_ram(const NESVecEnv* env, int index);
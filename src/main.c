@@ -41,6 +41,9 @@
 
 
 #include "emulator.h"
+#include "wavexport.h"
+#include "batch.h"
+#include "bench.h"
 #include "utils.h"
 
 #include <string.h>
@@ -53,14 +56,41 @@ int main(int argc, char *argv[]){
         } else if (strcmp(argv[1], "--help")==0 || strcmp(argv[1], "-h")==0) {
             printf(
                 "Usage: ./nes filename [options...]\n"
+                "       ./nes --render-wav <output dir> [-j threads] <file|dir>...\n"
+                "       ./nes --batch <list> [-j threads] [--frames N] [--report file.csv|file.json]\n"
+                "       ./nes --bench [--frames N] [--runs N] [--baseline file] [--timings file] [--threshold pct] [--update]\n"
                 "Options:\n"
                 "  --help                     Show this help message\n"
                 "  -genie <file>              Specify the genie file to load\n"
                 "  -save <file>               Specify file to save\n"
                 "  --multiplayer              Enable multiple controllers on one keyboard\n"
                 "  --no-save                  Disable saving the game\n"
+                "  --run-ahead <frames>       Show frames emulated ahead to reduce input lag\n"
+                "  --run-ahead-instance       Run ahead on a second emulator instead of restoring state\n"
+                "  --spin-margin <us>         Busy wait this long before each frame deadline\n"
+                "  --pacing <mode>            Wait on the timer, audio or vsync between frames\n"
+                "  --fast-forward             Run faster than real time as if ` was held\n"
+                "  --ff-speed <n>             Fast-forward at n times real time, 0 for uncapped\n"
+                "  --no-late-input            Poll input only at the start of each frame\n"
+                "  --profile <file.json>      Write per frame time spent in each subsystem\n"
+                "  --perf-counters            Add per frame hardware counters to the profile (Linux)\n"
+                "  --trace-events <file.json> Write a timeline of frames and emulator events\n"
+                "  --record <file.nmv>        Record the controllers from power on as an input movie\n"
+                "  --play <file.nmv>          Play an input movie, with --headless the session ends with it\n"
+                "  --frame-hashes <file.csv>  Write the RAM and screen hash of every frame\n"
+                "  --no-render-thread         Present frames from the emulation thread\n"
+                "  --headless <frames>        Run frames without window or audio device\n"
+                "  --render-wav               Render every track of the given NSF/NSFe files to WAV\n"
+                "  --batch                    Run each ROM in a list headless and report frame and RAM hashes\n"
+                "  --bench                    Time the built in workloads and compare them with a baseline\n"
             );
             return 0;
+        } else if (strcmp(argv[1], "--render-wav")==0) {
+            return export_wav(argc, argv);
+        } else if (strcmp(argv[1], "--batch")==0) {
+            return run_batch(argc, argv);
+        } else if (strcmp(argv[1], "--bench")==0) {
+            return run_bench(argc, argv);
         }
     }
     printf(
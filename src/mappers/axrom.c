@@ -49,6 +49,7 @@ void load_AOROM(Mapper* mapper){
     mapper->write_PRG = write_PRG;
     mapper->read_PRG = read_PRG;
     mapper->PRG_ptr = mapper->PRG_ROM;
+    mapper->PRG_window = 0x8000;
 }
 
 static void write_PRG(Mapper* mapper, uint16_t address, uint8_t value){
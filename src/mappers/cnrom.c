@@ -55,6 +55,7 @@ void load_CNROM(Mapper* mapper){
     mapper->read_CHR = read_CHR;
     mapper->write_CHR = write_CHR;
     mapper->CHR_ptr = mapper->CHR_ROM;
+    mapper->CHR_window = 0x2000;
 }
 
 
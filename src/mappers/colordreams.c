@@ -42,12 +42,14 @@
 
 #include "mapper.h"
 #include "utils.h"
+#include "savestate.h"
 
 static uint8_t read_PRG(Mapper*, uint16_t);
 static void write_PRG(Mapper*, uint16_t, uint8_t);
 static uint8_t read_CHR(Mapper*, uint16_t);
 static void write_ROM(Mapper* mapper, uint16_t address, uint8_t value);
 static void reset(Mapper* mapper);
+static void serialize(Mapper* mapper, StateStream* stream);
 
 static void select_banks(Mapper* mapper);
 
@@ -62,18 +64,24 @@ void load_colordreams(Mapper* mapper){
     mapper->read_CHR = read_CHR;
     mapper->PRG_ptr = mapper->PRG_ROM;
     mapper->CHR_ptr = mapper->CHR_ROM;
+    mapper->PRG_window = 0x8000;
+    mapper->CHR_window = 0x2000;
 }
 
 void load_colordreams46(Mapper* mapper) {
     // two store the two registers
     // CHR = 0, PRG = 1
     mapper->extension = calloc(1, sizeof(reg_t));
+    mapper->extension_size = sizeof(reg_t);
     mapper->write_ROM = write_ROM;
     mapper->read_PRG = read_PRG;
     mapper->read_CHR = read_CHR;
     mapper->PRG_ptr = mapper->PRG_ROM;
     mapper->CHR_ptr = mapper->CHR_ROM;
+    mapper->PRG_window = 0x8000;
+    mapper->CHR_window = 0x2000;
     mapper->reset = reset;
+    mapper->serialize = serialize;
 }
 
 void reset(Mapper* mapper) {
@@ -113,6 +121,13 @@ static void write_ROM(Mapper* mapper, uint16_t address, uint8_t value){
     select_banks(mapper);
 }
 
+static void serialize(Mapper* mapper, StateStream* stream) {
+    // bank pointers are restored by the generic mapper state
+    reg_t* reg = mapper->extension;
+    state_u8(stream, &reg->CHR);
+    state_u8(stream, &reg->PRG);
+}
+
 static void select_banks(Mapper* mapper) {
     const reg_t* reg = mapper->extension;
     mapper->PRG_ptr = mapper->PRG_ROM + reg->PRG * 0x8000;
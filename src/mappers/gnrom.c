@@ -52,6 +52,8 @@ void load_GNROM(Mapper* mapper){
     mapper->read_CHR = read_CHR;
     mapper->PRG_ptr = mapper->PRG_ROM;
     mapper->CHR_ptr = mapper->CHR_ROM;
+    mapper->PRG_window = 0x8000;
+    mapper->CHR_window = 0x2000;
 }
 
 static uint8_t read_PRG(Mapper* mapper, uint16_t address){
@@ -48,10 +48,10 @@
 #include "emulator.h"
 #include "genie.h"
 #include "nsf.h"
+#include "savestate.h"
 
-static char* save_file_path;
 
-static void select_mapper(Mapper*  mapper);
+static int select_mapper(Mapper*  mapper);
 static void set_mapping(Mapper* mapper, uint16_t tr, uint16_t tl, uint16_t br, uint16_t bl);
 
 // generic mapper implementations
@@ -63,7 +63,7 @@ static uint8_t read_ROM(Mapper*, uint16_t);
 static void write_ROM(Mapper*, uint16_t, uint8_t);
 static void on_scanline(Mapper*);
 
-static void select_mapper(Mapper* mapper){
+static int select_mapper(Mapper* mapper){
     // load generic implementations
     mapper->read_PRG = read_PRG;
     mapper->write_PRG = write_PRG;
@@ -104,8 +104,9 @@ static void select_mapper(Mapper* mapper){
             break;
         default:
             LOG(ERROR, "Mapper no %u not implemented", mapper->mapper_num);
-            quit(EXIT_FAILURE);
+            return -1;
     }
+    return 0;
 }
 
 
@@ -149,6 +150,48 @@ void set_mirroring(Mapper* mapper, Mirroring mirroring){
     mapper->mirroring = mirroring;
 }
 
+size_t PRG_ROM_size(const Mapper* mapper){
+    return 0x4000 * mapper->PRG_banks;
+}
+
+
+size_t CHR_ROM_size(const Mapper* mapper){
+    return mapper->CHR_banks ? 0x2000 * mapper->CHR_banks : mapper->CHR_RAM_size;
+}
+
+
+void serialize_mapper(Mapper* mapper, struct StateStream* stream){
+    uint8_t mirroring = mapper->mirroring;
+    uint16_t name_table_map[4];
+    memcpy(name_table_map, mapper->name_table_map, sizeof(name_table_map));
+    state_ptr(stream, &mapper->PRG_ptr, mapper->PRG_ROM, PRG_ROM_size(mapper), mapper->PRG_window);
+    state_ptr(stream, &mapper->CHR_ptr, mapper->CHR_ROM, CHR_ROM_size(mapper), mapper->CHR_window);
+    state_u8(stream, &mirroring);
+    for(int i = 0; i < 4; i++)
+        state_u16(stream, &name_table_map[i]);
+    if(mapper->PRG_RAM != NULL)
+        state_pages(stream, mapper->PRG_RAM, mapper->RAM_size, &mapper->PRG_RAM_dirty);
+    if(mapper->CHR_RAM_size)
+        state_pages(stream, mapper->CHR_ROM, CHR_ROM_size(mapper), &mapper->CHR_RAM_dirty);
+    if(mapper->serialize != NULL)
+        mapper->serialize(mapper, stream);
+
+    if(!stream->loading || stream->error)
+        return;
+    // name table offsets index the 4KB of PPU V_RAM
+    for(int i = 0; i < 4; i++) {
+        if(name_table_map[i] > 0xC00)
+            stream->error = 1;
+    }
+    if(mirroring > FOUR_SCREEN)
+        stream->error = 1;
+    if(stream->error)
+        return;
+    memcpy(mapper->name_table_map, name_table_map, sizeof(name_table_map));
+    mapper->mirroring = mirroring;
+}
+
+
 static void on_scanline(Mapper* mapper) {
 
 }
@@ -183,6 +226,7 @@ static void write_ROM(Mapper* mapper, uint16_t address, uint8_t value){
         // extended ram
         if(mapper->PRG_RAM != NULL) {
             mapper->PRG_RAM[address - 0x6000] = value;
+            mark_dirty(&mapper->PRG_RAM_dirty, address - 0x6000);
         } else {
             LOG(DEBUG, "Attempted to write to non existent PRG RAM");
         }
@@ -215,43 +259,76 @@ static void write_CHR(Mapper* mapper, uint16_t address, uint8_t value){
         return;
     }
     mapper->CHR_ROM[address] = value;
+    mark_dirty(&mapper->CHR_RAM_dirty, address);
 }
 
 
-void load_file(char* file_name, char* game_genie, char* save_file, Mapper* mapper) {
-    save_file_path = save_file;
-
+int load_file(char* file_name, char* game_genie, char* save_file, Mapper* mapper) {
     SDL_RWops *file;
     file = SDL_RWFromFile(file_name, "rb");
 
     if(file == NULL){
         LOG(ERROR, "file '%s' not found", file_name);
-        quit(EXIT_FAILURE);
+        return -1;
     }
+    int loaded = load_ROM(file, file_name, game_genie, save_file, mapper);
+    SDL_RWclose(file);
+    return loaded;
+}
+
+
+int load_ROM_image(const uint8_t* rom, size_t size, Mapper* mapper) {
+    if(rom == NULL || size < INES_HEADER_SIZE || memcmp(rom, "NES\x1A", 4) != 0) {
+        LOG(ERROR, "Not an iNES image");
+        return -1;
+    }
+    SDL_RWops* file = SDL_RWFromConstMem(rom, (int)size);
+    if(file == NULL) {
+        LOG(ERROR, "%s", SDL_GetError());
+        return -1;
+    }
+    int loaded = load_ROM(file, NULL, NULL, NULL, mapper);
+    SDL_RWclose(file);
+    return loaded;
+}
 
+
+static int reject_ROM(Mapper* mapper) {
+    // frees what was loaded so far without writing a save
+    mapper->save_file = NULL;
+    mapper->have_battery_backed_sram = 0;
+    free_mapper(mapper);
+    memset(mapper, 0, sizeof(Mapper));
+    return -1;
+}
+
+
+int load_ROM(SDL_RWops* file, const char* file_name, char* game_genie, char* save_file, Mapper* mapper) {
     // clear mapper
     memset(mapper, 0, sizeof(Mapper));
+    mapper->save_file = save_file;
 
     uint8_t header[INES_HEADER_SIZE];
-    SDL_RWread(file, header, INES_HEADER_SIZE, 1);
+    if(SDL_RWread(file, header, INES_HEADER_SIZE, 1) != 1) {
+        LOG(ERROR, "file is too short");
+        return -1;
+    }
 
     if(strncmp((char*)header, "NESM\x1A", 5) == 0){
         LOG(INFO, "Using NSF format");
         load_nsf(file, mapper);
-        SDL_RWclose(file);
-        return;
+        return 0;
     }
 
     if(strncmp((char*)header, "NSFE", 4) == 0){
         LOG(INFO, "Using NSFe format");
         load_nsfe(file, mapper);
-        SDL_RWclose(file);
-        return;
+        return 0;
     }
 
     if(strncmp((char*)header, "NES\x1A", 4) != 0){
         LOG(ERROR, "unknown file format");
-        quit(EXIT_FAILURE);
+        return -1;
     }
 
     uint8_t mapnum = header[7] & 0x0C;
@@ -291,7 +368,7 @@ void load_file(char* file_name, char* game_genie, char* save_file, Mapper* mappe
 
     if(header[6] & BIT_2) {
         LOG(ERROR, "Trainer not supported");
-        quit(EXIT_FAILURE);
+        return -1;
     }
 
     Mirroring mirroring;
@@ -358,7 +435,7 @@ void load_file(char* file_name, char* game_genie, char* save_file, Mapper* mappe
             case 3:
                 mapper->type = DENDY;
                 LOG(ERROR, "Dendy ROM not supported");
-                quit(EXIT_FAILURE);
+                return -1;
             default:
                 break;
         }
@@ -369,22 +446,33 @@ void load_file(char* file_name, char* game_genie, char* save_file, Mapper* mappe
         mapper->RAM_size = 0x2000;
     }
 
+    if(!mapper->PRG_banks) {
+        LOG(ERROR, "ROM has no PRG banks");
+        return -1;
+    }
+    // snapshots track RAM in pages, larger regions are not supported
+    if(mapper->RAM_size > DIRTY_MAX_PAGES * DIRTY_PAGE_SIZE || mapper->CHR_RAM_size > DIRTY_MAX_PAGES * DIRTY_PAGE_SIZE) {
+        LOG(ERROR, "PRG-RAM or CHR-RAM size not supported");
+        return -1;
+    }
+
     if(mapper->RAM_size) {
-        mapper->PRG_RAM = malloc(mapper->RAM_size);
+        mapper->PRG_RAM = calloc(mapper->RAM_size, 1);
 
         /*
             Carrega o jogo se ele exisitr
         */
-        if (save_file_path!=NULL) {
-        FILE *file = fopen(save_file_path, "rb");
+        if (mapper->save_file!=NULL) {
+        FILE *file = fopen(mapper->save_file, "rb");
         if (file == NULL || !mapper->have_battery_backed_sram) {
             memset(mapper->PRG_RAM, 0, mapper->RAM_size);
         } else {
             if (fread(mapper->PRG_RAM, 1, mapper->RAM_size, file) != mapper->RAM_size) {
                 LOG(ERROR, "Error loading save file!\n");
-                return;
+                fclose(file);
+                return reject_ROM(mapper);
             }
-            LOG(INFO, "Loading game save from %s", save_file_path);
+            LOG(INFO, "Loading game save from %s", mapper->save_file);
             fclose(file);
         }
         }
@@ -397,7 +485,7 @@ void load_file(char* file_name, char* game_genie, char* save_file, Mapper* mappe
             LOG(INFO, "CHR-ROM Not specified, Assuming 8kb CHR-RAM");
         }
 
-        if(strstr(file_name, "(E)") != NULL && mapper->type == NTSC) {
+        if(file_name != NULL && strstr(file_name, "(E)") != NULL && mapper->type == NTSC) {
             // probably PAL ROM
             mapper->type = PAL;
         }
@@ -407,11 +495,17 @@ void load_file(char* file_name, char* game_genie, char* save_file, Mapper* mappe
     LOG(INFO, "CHR banks (8KB): %u", mapper->CHR_banks);
 
     mapper->PRG_ROM = malloc(0x4000 * mapper->PRG_banks);
-    SDL_RWread(file, mapper->PRG_ROM, 0x4000 * mapper->PRG_banks, 1);
+    if(SDL_RWread(file, mapper->PRG_ROM, 0x4000 * mapper->PRG_banks, 1) != 1) {
+        LOG(ERROR, "PRG-ROM is shorter than the header says");
+        return reject_ROM(mapper);
+    }
 
     if(mapper->CHR_banks) {
         mapper->CHR_ROM = malloc(0x2000 * mapper->CHR_banks);
-        SDL_RWread(file, mapper->CHR_ROM, 0x2000 * mapper->CHR_banks, 1);
+        if(SDL_RWread(file, mapper->CHR_ROM, 0x2000 * mapper->CHR_banks, 1) != 1) {
+            LOG(ERROR, "CHR-ROM is shorter than the header says");
+            return reject_ROM(mapper);
+        }
     }else{
         if(!mapper->CHR_RAM_size) {
             LOG(INFO, "No CHR-RAM or CHR-ROM specified, Using 8kb CHR-RAM");
@@ -420,6 +514,8 @@ void load_file(char* file_name, char* game_genie, char* save_file, Mapper* mappe
         mapper->CHR_ROM = malloc(mapper->CHR_RAM_size);
         memset(mapper->CHR_ROM, 0, mapper->CHR_RAM_size);
     }
+    init_dirty_pages(&mapper->PRG_RAM_dirty, mapper->PRG_RAM != NULL ? mapper->RAM_size : 0);
+    init_dirty_pages(&mapper->CHR_RAM_dirty, mapper->CHR_RAM_size ? CHR_ROM_size(mapper) : 0);
 
     switch (mapper->type) {
         case NTSC:
@@ -437,33 +533,58 @@ void load_file(char* file_name, char* game_genie, char* save_file, Mapper* mappe
     }
 
     LOG(INFO, "Using mapper #%d", mapper->mapper_num);
-    select_mapper(mapper);
+    if(select_mapper(mapper) < 0)
+        return reject_ROM(mapper);
     set_mirroring(mapper, mirroring);
 
     if(game_genie != NULL){
         LOG(INFO, "-------- Game Genie Cartridge info ---------");
         load_genie(game_genie, mapper);
     }
-    SDL_RWclose(file);
+    return 0;
+}
+
+void clone_mapper(Mapper* clone, const Mapper* mapper){
+    // ROM is shared, writable memory and the extension get their own copy.
+    // Bank pointers still refer to the original until a state is loaded.
+    // Snapshots copy the clone's regions in full the first time they see them
+    memcpy(clone, mapper, sizeof(Mapper));
+    clone->shared_ROM = 1;
+    clone->have_battery_backed_sram = 0;
+    clone->save_file = NULL;
+    clone->genie = NULL;
+    clone->NSF = NULL;
+    if(mapper->PRG_RAM != NULL) {
+        clone->PRG_RAM = malloc(mapper->RAM_size);
+        memcpy(clone->PRG_RAM, mapper->PRG_RAM, mapper->RAM_size);
+    }
+    if(mapper->CHR_RAM_size) {
+        clone->CHR_ROM = malloc(CHR_ROM_size(mapper));
+        memcpy(clone->CHR_ROM, mapper->CHR_ROM, CHR_ROM_size(mapper));
+    }
+    if(mapper->extension != NULL) {
+        clone->extension = malloc(mapper->extension_size);
+        memcpy(clone->extension, mapper->extension, mapper->extension_size);
+    }
 }
 
 void free_mapper(Mapper* mapper){
-    if(mapper->PRG_ROM != NULL)
+    if(mapper->PRG_ROM != NULL && !mapper->shared_ROM)
         free(mapper->PRG_ROM);
-    if(mapper->CHR_ROM != NULL)
+    if(mapper->CHR_ROM != NULL && (!mapper->shared_ROM || mapper->CHR_RAM_size))
         free(mapper->CHR_ROM);
     if(mapper->PRG_RAM != NULL) {
         // Apenas se o cartucho tiver a capacidade de salvar jogos
-        if (mapper->have_battery_backed_sram && save_file_path != NULL) {
+        if (mapper->have_battery_backed_sram && mapper->save_file != NULL) {
             /*
                 Salva o jogo se ele exisitr
             */
-            FILE *file = fopen(save_file_path, "wb");
+            FILE *file = fopen(mapper->save_file, "wb");
             if (file == NULL) {
                 perror("Failed to open save file");
             } else {
                 fwrite(mapper->PRG_RAM, 1, mapper->RAM_size, file);
-                LOG(INFO, "Saving game in %s", save_file_path);
+                LOG(INFO, "Saving game in %s", mapper->save_file);
 
                 fclose(file);
             }
@@ -46,6 +46,8 @@
 #include <stdio.h>
 #include <stdbool.h>
 
+#include "utils.h"
+
 #define INES_HEADER_SIZE 16
 
 typedef enum TVSystem{
@@ -86,6 +88,7 @@ typedef enum MapperFormat {
 struct Genie;
 struct Emulator;
 struct NSF;
+struct StateStream;
 
 typedef struct Mapper{
     uint8_t* CHR_ROM;
@@ -93,11 +96,16 @@ typedef struct Mapper{
     uint8_t* PRG_RAM;
     uint8_t* PRG_ptr;
     uint8_t* CHR_ptr;
+    // bytes read through PRG_ptr and CHR_ptr
+    size_t PRG_window;
+    size_t CHR_window;
     uint16_t PRG_banks;
     uint16_t CHR_banks;
     size_t CHR_RAM_size;
     uint8_t RAM_banks;
     size_t RAM_size;
+    DirtyPages PRG_RAM_dirty;
+    DirtyPages CHR_RAM_dirty;
     Mirroring mirroring;
     TVSystem type;
     MapperFormat format;
@@ -107,6 +115,8 @@ typedef struct Mapper{
     uint8_t submapper;
     uint8_t is_nsf;
     bool have_battery_backed_sram;
+    // battery backed PRG-RAM is loaded from and saved to this file
+    char* save_file;
     void (*on_scanline)(struct Mapper*);
     uint8_t (*read_ROM)(struct Mapper*, uint16_t);
     void (*write_ROM)(struct Mapper*, uint16_t, uint8_t);
@@ -115,20 +125,35 @@ typedef struct Mapper{
     uint8_t (*read_CHR)(struct Mapper*, uint16_t);
     void (*write_CHR)(struct Mapper*, uint16_t , uint8_t);
     void (*reset)(struct Mapper*);
+    // saves or restores the extension struct, bank pointers as offsets
+    void (*serialize)(struct Mapper*, struct StateStream*);
 
     // mapper extension structs would be attached here
     // memory should be allocated dynamically and should
     // not be freed since this is done by the generic mapper functions
     void* extension;
+    size_t extension_size;
+    // ROM buffers belong to the mapper this one was cloned from
+    uint8_t shared_ROM;
     // pointer to game genie if any
     struct Genie* genie;
     struct NSF* NSF;
     struct Emulator* emulator;
 } Mapper;
 
-void load_file(char* file_name, char* game_genie, char* save_file, Mapper* mapper);
+// returns -1 if the file is missing or can't be used
+int load_file(char* file_name, char* game_genie, char* save_file, Mapper* mapper);
+// file_name is only used to guess the TV system and may be NULL,
+// returns -1 and leaves the mapper empty if the ROM can't be used
+int load_ROM(SDL_RWops* file, const char* file_name, char* game_genie, char* save_file, Mapper* mapper);
+// in memory iNES image without genie or save file, returns -1 if it can't be used
+int load_ROM_image(const uint8_t* rom, size_t size, Mapper* mapper);
 void free_mapper(struct Mapper* mapper);
+void clone_mapper(Mapper* clone, const Mapper* mapper);
 void set_mirroring(Mapper* mapper, Mirroring mirroring);
+void serialize_mapper(Mapper* mapper, struct StateStream* stream);
+size_t PRG_ROM_size(const Mapper* mapper);
+size_t CHR_ROM_size(const Mapper* mapper);
 
 // mapper specifics
 
@@ -45,6 +45,7 @@
 
 #include "mapper.h"
 #include "utils.h"
+#include "savestate.h"
 
 typedef struct{
     uint8_t PRG_reg;
@@ -75,13 +76,16 @@ static void write_PRG(Mapper*, uint16_t, uint8_t);
 static uint8_t read_CHR(Mapper*, uint16_t);
 static void set_PRG_banks(MMC1_t* mmc1, Mapper* mapper);
 static void set_CHR_banks(MMC1_t* mmc1, Mapper* mapper);
+static void serialize(Mapper* mapper, StateStream* stream);
 
 void load_MMC1(Mapper* mapper){
     mapper->read_PRG = read_PRG;
     mapper->write_PRG = write_PRG;
     mapper->read_CHR = read_CHR;
+    mapper->serialize = serialize;
     MMC1_t* mmc1 = calloc(1, sizeof(MMC1_t));
     mapper->extension = mmc1;
+    mapper->extension_size = sizeof(MMC1_t);
     mmc1->reg = REG_INIT;
     mmc1->PRG_mode = 3;
     mmc1->cpu_cycle = -1;
@@ -92,10 +96,9 @@ void load_MMC1(Mapper* mapper){
     mmc1->CHR_clamp = next_power_of_2(mapper->CHR_banks * 2);
     mmc1->CHR_clamp = mmc1->CHR_clamp > 0 ? mmc1->CHR_clamp - 1: 0;
 
-    if(mapper->CHR_banks) {
-        mmc1->CHR_bank1 = mapper->CHR_ROM;
-        mmc1->CHR_bank2 = mmc1->CHR_bank1 + 0x1000;
-    }
+    // set for CHR-RAM too so a save state never has to restore them unset
+    mmc1->CHR_bank1 = mapper->CHR_ROM;
+    mmc1->CHR_bank2 = mmc1->CHR_bank1 + 0x1000;
 
     mmc1->PRG_bank1 = mapper->PRG_ROM;
     mmc1->PRG_bank2 = mapper->PRG_ROM + (mapper->PRG_banks - 1) * 0x4000;
@@ -231,3 +234,20 @@ static uint8_t read_CHR(Mapper* mapper, uint16_t address){
         return *(((MMC1_t*)mapper->extension)->CHR_bank1 + address);
     return *(((MMC1_t*)mapper->extension)->CHR_bank2 + (address & 0xfff));
 }
+
+static void serialize(Mapper* mapper, StateStream* stream){
+    MMC1_t* mmc1 = mapper->extension;
+    size_t PRG_size = PRG_ROM_size(mapper);
+    size_t CHR_size = CHR_ROM_size(mapper);
+    state_u8(stream, &mmc1->PRG_reg);
+    state_u8(stream, &mmc1->CHR1_reg);
+    state_u8(stream, &mmc1->CHR2_reg);
+    state_ptr(stream, &mmc1->PRG_bank1, mapper->PRG_ROM, PRG_size, 0x4000);
+    state_ptr(stream, &mmc1->PRG_bank2, mapper->PRG_ROM, PRG_size, 0x4000);
+    state_ptr(stream, &mmc1->CHR_bank1, mapper->CHR_ROM, CHR_size, 0x1000);
+    state_ptr(stream, &mmc1->CHR_bank2, mapper->CHR_ROM, CHR_size, 0x1000);
+    state_u8(stream, &mmc1->CHR_mode);
+    state_u8(stream, &mmc1->PRG_mode);
+    state_u8(stream, &mmc1->reg);
+    state_size(stream, &mmc1->cpu_cycle);
+}
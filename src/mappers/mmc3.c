@@ -46,6 +46,7 @@
 #include "mapper.h"
 #include "utils.h"
 #include "cpu6502.h"
+#include "savestate.h"
 
 typedef struct {
     uint8_t *PRG_bank_ptrs[4];
@@ -72,14 +73,18 @@ static void write_bank_data(Mapper *mapper, uint8_t val);
 
 static void on_scanline(Mapper*);
 
+static void serialize(Mapper*, StateStream*);
+
 
 void load_MMC3(Mapper *mapper) {
     mapper->read_PRG = read_PRG;
     mapper->write_PRG = write_PRG;
     mapper->read_CHR = read_CHR;
     mapper->on_scanline = on_scanline;
+    mapper->serialize = serialize;
     MMC3_t *mmc3 = calloc(1, sizeof(MMC3_t));
     mapper->extension = mmc3;
+    mapper->extension_size = sizeof(MMC3_t);
     // PRG banks in 8k chunks
     mmc3->PRG_clamp = next_power_of_2(mapper->PRG_banks * 2);
     mmc3->PRG_clamp = mmc3->PRG_clamp > 0 ? mmc3->PRG_clamp - 1: 0;
@@ -228,3 +233,27 @@ uint8_t read_CHR(Mapper *mapper, uint16_t addr) {
     }
     return mmc3->CHR_bank_ptrs[ptr_index][addr];
 }
+
+static void serialize(Mapper *mapper, StateStream *stream) {
+    MMC3_t *mmc3 = mapper->extension;
+    uint8_t next_bank_data = mmc3->next_bank_data;
+    for(int i = 0; i < 4; i++)
+        state_ptr(stream, &mmc3->PRG_bank_ptrs[i], mapper->PRG_ROM, PRG_ROM_size(mapper), 0x2000);
+    for(int i = 0; i < 8; i++)
+        state_ptr(stream, &mmc3->CHR_bank_ptrs[i], mapper->CHR_ROM, CHR_ROM_size(mapper), 0x400);
+    state_u8(stream, &mmc3->PRG_mode);
+    state_u8(stream, &mmc3->CHR_inversion);
+    state_u8(stream, &next_bank_data);
+    state_u8(stream, &mmc3->IRQ_latch);
+    state_u8(stream, &mmc3->IRQ_counter);
+    state_u8(stream, &mmc3->IRQ_cleared);
+    state_u8(stream, &mmc3->IRQ_enabled);
+    if(!stream->loading || stream->error)
+        return;
+    // selects one of the 8 bank registers
+    if(next_bank_data > 7) {
+        stream->error = 1;
+        return;
+    }
+    mmc3->next_bank_data = next_bank_data;
+}
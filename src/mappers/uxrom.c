@@ -59,4 +59,5 @@ void load_UXROM(Mapper* mapper){
     // last bank offset
     mapper->clamp = (mapper->PRG_banks - 1) * 0x4000;
     mapper->PRG_ptr = mapper->PRG_ROM;
+    mapper->PRG_window = 0x4000;
 }
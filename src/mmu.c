@@ -51,6 +51,7 @@ void init_mem(Emulator* emulator){
     mem->mapper = &emulator->mapper;
 
     memset(mem->RAM, 0, RAM_SIZE);
+    init_dirty_pages(&mem->RAM_dirty, RAM_SIZE);
     init_joypad(&mem->joy1, 0, emulator->settings.multiple_controllers_in_one_keyboard);
     init_joypad(&mem->joy2, 1, emulator->settings.multiple_controllers_in_one_keyboard);
 }
@@ -69,6 +70,7 @@ void write_mem(Memory* mem, uint16_t address, uint8_t value){
 
     if(address < RAM_END) {
         mem->RAM[address % RAM_SIZE] = value;
+        mark_dirty(&mem->RAM_dirty, address % RAM_SIZE);
         return;
     }
 
@@ -117,6 +119,8 @@ void write_mem(Memory* mem, uint16_t address, uint8_t value){
                 ppu->bus = value;
                 break;
             case JOY1:
+                if(mem->emulator->input_pending && (value & 1))
+                    poll_input_late(mem->emulator);
                 write_joypad(&mem->joy1, value);
                 write_joypad(&mem->joy2, value);
                 mem->bus = (old & 0xf0) | (value & 0xf);
@@ -184,9 +188,14 @@ void write_mem(Memory* mem, uint16_t address, uint8_t value){
             default:
                 break;
         }
+        // register writes can change any channel's output level
+        if(address >= APU_P1_CTRL && address <= FRAME_COUNTER)
+            update_channel_levels(apu);
         return;
     }
 
+    if(address >= 0x8000)
+        TIMELINE_INSTANT("mapper write");
     mem->mapper->write_ROM(mem->mapper, address, value);
 }
 uint8_t read_mem(Memory* mem, uint16_t address){
@@ -223,10 +232,14 @@ uint8_t read_mem(Memory* mem, uint16_t address){
                 mem->bus = ppu->bus;
                 return mem->bus;
             case JOY1:
+                if(mem->emulator->input_pending)
+                    poll_input_late(mem->emulator);
                 mem->bus &= 0xe0;
                 mem->bus |= read_joypad(&mem->joy1) & 0x1f;
                 return mem->bus;
             case JOY2:
+                if(mem->emulator->input_pending)
+                    poll_input_late(mem->emulator);
                 mem->bus &= 0xe0;
                 mem->bus |= read_joypad(&mem->joy2) & 0x1f;
                 return mem->bus;
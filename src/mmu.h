@@ -104,6 +104,7 @@ struct Emulator;
 
 typedef struct Memory {
     uint8_t RAM[RAM_SIZE];
+    DirtyPages RAM_dirty;
     uint8_t bus;
     JoyPad joy1;
     JoyPad joy2;
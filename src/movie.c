@@ -0,0 +1,256 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "movie.h"
+#include "emulator.h"
+#include "utils.h"
+
+
+static uint64_t ROM_hash(const Mapper* mapper);
+static void write_run(Movie* movie);
+static int read_run(Movie* movie);
+static void write_u32(uint8_t* data, uint32_t value);
+static uint32_t read_u32(const uint8_t* data);
+static void end_playback(Emulator* emulator);
+
+
+static uint64_t ROM_hash(const Mapper* mapper){
+    uint64_t hash = hash_bytes(mapper->PRG_ROM, PRG_ROM_size(mapper), FNV_OFFSET);
+    if(mapper->CHR_ROM != NULL)
+        hash = hash_bytes(mapper->CHR_ROM, CHR_ROM_size(mapper), hash);
+    return hash;
+}
+
+
+static void write_u32(uint8_t* data, uint32_t value){
+    for(int i = 0; i < 4; i++)
+        data[i] = value >> (i * 8);
+}
+
+
+static uint32_t read_u32(const uint8_t* data){
+    uint32_t value = 0;
+    for(int i = 0; i < 4; i++)
+        value |= (uint32_t)data[i] << (i * 8);
+    return value;
+}
+
+
+int start_recording(Movie* movie, const char* path, const Mapper* mapper){
+    memset(movie, 0, sizeof(Movie));
+    movie->file = fopen(path, "wb");
+    if(movie->file == NULL) {
+        LOG(ERROR, "Could not create movie %s", path);
+        return -1;
+    }
+    movie->ROM_hash = ROM_hash(mapper);
+    // the frame count is filled in by stop_movie
+    uint8_t header[MOVIE_HEADER_SIZE] = {0};
+    memcpy(header, MOVIE_MAGIC, MOVIE_MAGIC_SIZE);
+    header[MOVIE_MAGIC_SIZE] = MOVIE_VERSION;
+    write_u32(header + 8, movie->ROM_hash);
+    write_u32(header + 12, movie->ROM_hash >> 32);
+    fwrite(header, 1, MOVIE_HEADER_SIZE, movie->file);
+    movie->mode = MOVIE_RECORD;
+    movie->pending = MOVIE_POWER;
+    LOG(INFO, "Recording movie to %s", path);
+    return 0;
+}
+
+
+int start_playback(Movie* movie, const char* path, const Mapper* mapper){
+    memset(movie, 0, sizeof(Movie));
+    movie->file = fopen(path, "rb");
+    if(movie->file == NULL) {
+        LOG(ERROR, "Could not open movie %s", path);
+        return -1;
+    }
+    uint8_t header[MOVIE_HEADER_SIZE];
+    if(fread(header, 1, MOVIE_HEADER_SIZE, movie->file) != MOVIE_HEADER_SIZE
+        || memcmp(header, MOVIE_MAGIC, MOVIE_MAGIC_SIZE) != 0) {
+        LOG(ERROR, "%s is not a movie", path);
+        goto fail;
+    }
+    if(header[MOVIE_MAGIC_SIZE] != MOVIE_VERSION) {
+        LOG(ERROR, "%s: unsupported movie version %u", path, header[MOVIE_MAGIC_SIZE]);
+        goto fail;
+    }
+    movie->ROM_hash = read_u32(header + 8) | (uint64_t)read_u32(header + 12) << 32;
+    if(movie->ROM_hash != ROM_hash(mapper)) {
+        LOG(ERROR, "%s was recorded on a different ROM", path);
+        goto fail;
+    }
+    movie->length = read_u32(header + 16);
+    if(read_run(movie) < 0) {
+        LOG(ERROR, "%s has no frames", path);
+        goto fail;
+    }
+    movie->mode = MOVIE_PLAY;
+    LOG(INFO, "Playing movie %s (%u frames)", path, movie->length);
+    return 0;
+
+fail:
+    fclose(movie->file);
+    movie->file = NULL;
+    return -1;
+}
+
+
+int open_hash_log(Movie* movie, const char* path){
+    movie->hash_log = fopen(path, "w");
+    if(movie->hash_log == NULL) {
+        LOG(ERROR, "Could not create %s", path);
+        return -1;
+    }
+    fprintf(movie->hash_log, "frame,ram_hash,screen_hash\n");
+    return 0;
+}
+
+
+static void write_run(Movie* movie){
+    uint8_t record[3 + 5] = {movie->events, movie->pads[0], movie->pads[1]};
+    size_t size = 3;
+    // 7 bits of the length per byte, the high bit marks that more follow
+    uint32_t run = movie->run;
+    do {
+        record[size++] = (run & 0x7f) | (run > 0x7f ? 0x80 : 0);
+        run >>= 7;
+    } while(run);
+    fwrite(record, 1, size, movie->file);
+}
+
+
+static int read_run(Movie* movie){
+    uint8_t record[3];
+    if(fread(record, 1, 3, movie->file) != 3)
+        return -1;
+    movie->events = record[0];
+    movie->pads[0] = record[1];
+    movie->pads[1] = record[2];
+    movie->run = 0;
+    movie->run_start = 1;
+    for(int shift = 0; shift < 35; shift += 7) {
+        int byte = fgetc(movie->file);
+        if(byte == EOF)
+            return -1;
+        movie->run |= (uint32_t)(byte & 0x7f) << shift;
+        if(!(byte & 0x80))
+            return movie->run ? 0 : -1;
+    }
+    return -1;
+}
+
+
+static void end_playback(Emulator* emulator){
+    Movie* movie = &emulator->movie;
+    LOG(INFO, "Movie ended after %u frames", movie->frame);
+    movie->mode = MOVIE_ENDED;
+    emulator->mem.joy1.movie_input = false;
+    emulator->mem.joy2.movie_input = false;
+    emulator->mem.joy1.status = 0;
+    emulator->mem.joy2.status = 0;
+}
+
+
+void movie_frame_start(Emulator* emulator){
+    Movie* movie = &emulator->movie;
+    if(movie->mode != MOVIE_PLAY)
+        return;
+    if(movie->run_start) {
+        movie->run_start = 0;
+        if(movie->events & MOVIE_POWER && movie->frame) {
+            LOG(WARN, "Power cycle at movie frame %u is played as a reset", movie->frame);
+            movie->events |= MOVIE_RESET;
+        }
+        if(movie->events & MOVIE_RESET)
+            reset_emulator(emulator);
+    }
+    // turbo toggles are part of the recorded buttons
+    emulator->mem.joy1.movie_input = true;
+    emulator->mem.joy2.movie_input = true;
+    emulator->mem.joy1.status = movie->pads[0];
+    emulator->mem.joy2.status = movie->pads[1];
+    movie->run--;
+}
+
+
+void movie_frame_end(Emulator* emulator, const uint32_t* screen){
+    Movie* movie = &emulator->movie;
+    if(movie->mode == MOVIE_RECORD) {
+        // the buttons every controller read of the frame saw, turbo
+        // only decides which of them toggle
+        uint8_t pad1 = emulator->mem.joy1.status & 0xff, pad2 = emulator->mem.joy2.status & 0xff;
+        if(movie->run && !movie->pending && pad1 == movie->pads[0] && pad2 == movie->pads[1]) {
+            movie->run++;
+        } else {
+            if(movie->run)
+                write_run(movie);
+            movie->events = movie->pending;
+            movie->pads[0] = pad1;
+            movie->pads[1] = pad2;
+            movie->run = 1;
+            movie->pending = 0;
+        }
+    }
+    if(movie->mode == MOVIE_RECORD || movie->mode == MOVIE_PLAY)
+        movie->frame++;
+    // the next run is read ahead so that playback ends with the last frame
+    if(movie->mode == MOVIE_PLAY && !movie->run && read_run(movie) < 0)
+        end_playback(emulator);
+
+    if(movie->hash_log != NULL) {
+        uint64_t hash = hash_bytes(emulator->mem.RAM, RAM_SIZE, FNV_OFFSET);
+        if(emulator->mapper.PRG_RAM != NULL)
+            hash = hash_bytes(emulator->mapper.PRG_RAM, emulator->mapper.RAM_size, hash);
+        fprintf(movie->hash_log, "%u,%016llx,", movie->logged++, (unsigned long long)hash);
+        if(screen != NULL)
+            fprintf(movie->hash_log, "%016llx\n", (unsigned long long)hash_bytes(screen, VISIBLE_DOTS * VISIBLE_SCANLINES * sizeof(uint32_t), FNV_OFFSET));
+        else
+            fprintf(movie->hash_log, "-\n");
+    }
+}
+
+
+void movie_event(Movie* movie, MovieEvent event){
+    if(movie->mode == MOVIE_RECORD)
+        movie->pending |= event;
+}
+
+
+void stop_movie(Movie* movie){
+    if(movie->mode == MOVIE_RECORD) {
+        if(movie->run)
+            write_run(movie);
+        uint8_t length[4];
+        write_u32(length, movie->frame);
+        fseek(movie->file, 16, SEEK_SET);
+        fwrite(length, 1, 4, movie->file);
+        LOG(INFO, "Recorded %u frames", movie->frame);
+    }
+    if(movie->file != NULL)
+        fclose(movie->file);
+    if(movie->hash_log != NULL)
+        fclose(movie->hash_log);
+    memset(movie, 0, sizeof(Movie));
+}
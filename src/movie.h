@@ -0,0 +1,84 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// header: magic, version, ROM hash and frame count
+#define MOVIE_MAGIC "NESMV\x1a"
+#define MOVIE_MAGIC_SIZE 6
+#define MOVIE_VERSION 1
+#define MOVIE_HEADER_SIZE 20
+
+struct Emulator;
+struct Mapper;
+
+typedef enum MovieMode {
+    MOVIE_OFF = 0,
+    MOVIE_RECORD,
+    MOVIE_PLAY,
+    // playback reached the end of the file
+    MOVIE_ENDED,
+} MovieMode;
+
+// applied before the first frame of a run
+typedef enum MovieEvent {
+    MOVIE_RESET = 1,
+    // the emulator was powered on, movies always start with one
+    MOVIE_POWER = 1 << 1,
+} MovieEvent;
+
+// Controller input for every emulated frame, stored as runs of frames
+// with the same buttons: events, pad 1, pad 2 and the run length as a
+// variable length integer. Recording starts from power on without a
+// battery save so that playback repeats the session exactly.
+typedef struct Movie {
+    FILE* file;
+    MovieMode mode;
+    // PRG and CHR ROM the movie was recorded on
+    uint64_t ROM_hash;
+    // frames in the file and frames recorded or played so far
+    uint32_t length;
+    uint32_t frame;
+    // the current run
+    uint8_t events;
+    uint8_t pads[2];
+    uint32_t run;
+    // the run's events are still to be applied
+    uint8_t run_start;
+    // events raised since the last recorded frame
+    uint8_t pending;
+    // RAM and screen hash of every frame, optional
+    FILE* hash_log;
+    uint32_t logged;
+} Movie;
+
+int start_recording(Movie* movie, const char* path, const struct Mapper* mapper);
+int start_playback(Movie* movie, const char* path, const struct Mapper* mapper);
+int open_hash_log(Movie* movie, const char* path);
+// called around every emulated frame, screen is NULL if it was not drawn
+void movie_frame_start(struct Emulator* emulator);
+void movie_frame_end(struct Emulator* emulator, const uint32_t* screen);
+void movie_event(Movie* movie, MovieEvent event);
+// finishes the file of a recording and closes the hash log
+void stop_movie(Movie* movie);
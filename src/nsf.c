@@ -55,7 +55,6 @@
 
 #define PRG_ROM_SIZE 0x8000
 #define PRG_RAM_SIZE 0x2000
-#define BAR_COUNT 128
 #define MAX_SILENCE 150 // frames
 
 static uint8_t read_PRG(const Mapper*, uint16_t);
@@ -536,7 +535,8 @@ void init_song(Emulator* emulator, size_t song_number) {
     init_cpu(emulator);
     emulator->apu.audio_start = 0;
     emulator->apu.sampler.index = 0;
-    SDL_PauseAudioDevice(emulator->g_ctx.audio_device, 1);
+    if(!emulator->settings.headless)
+        SDL_PauseAudioDevice(emulator->g_ctx.audio_device, 1);
 
     for(size_t i = 0; i < 14; i++) {
         write_mem(&emulator->mem, 0x4000 + i, 0);
@@ -572,6 +572,42 @@ void nsf_jsr(Emulator* emulator, uint16_t address) {
     emulator->cpu.pc = address;
 }
 
+void run_NSF_cycles(Emulator* emulator, NSF* nsf, size_t cycles) {
+    c6502* cpu = &emulator->cpu;
+    APU* apu = &emulator->apu;
+    while (cycles > 0) {
+        if(cpu->pc == NSF_SENTINEL_ADDR) {
+            // the CPU stays parked until the next play call,
+            // so the APU can catch up for the rest of the slice in one go
+            if(!nsf->initializing)
+                run_apu_cycles(apu, cycles);
+            return;
+        }
+        execute(cpu);
+        if(!nsf->initializing)
+            execute_apu(apu);
+        cycles--;
+    }
+}
+
+uint8_t update_NSF_fade(NSF* nsf, APU* apu) {
+    // returns 1 once the track has played for its full duration including the fade
+    if(nsf->times == NULL || nsf->initializing)
+        return 0;
+    double track_dur = nsf->times[nsf->current_song == 0 ? 0 : nsf->current_song - 1];
+    if(track_dur >= nsf->tick)
+        return 0;
+    if(nsf->tick_max < nsf->tick)
+        return 1;
+    if(nsf->fade != NULL) {
+        int fade_dur = nsf->fade[nsf->current_song == 0 ? 0 : nsf->current_song - 1];
+        apu->volume = (nsf->tick - track_dur) / (float)fade_dur;
+        // clamp to range (0,1) then invert
+        apu->volume = 1 - (apu->volume < 0 ? 0 : apu->volume > 1 ? 1 : apu->volume);
+    }
+    return 0;
+}
+
 void next_song(Emulator* emulator, NSF* nsf) {
     nsf->current_song = nsf->current_song >= nsf->total_songs ? 1 : nsf->current_song + 1;
     init_song(emulator, nsf->current_song);
@@ -582,19 +618,33 @@ void prev_song(Emulator* emulator, NSF* nsf) {
     init_song(emulator, nsf->current_song);
 }
 
-static double bin_boundaries[BAR_COUNT + 1] = {0};
-
+// the player UI needs SDL_ttf
+#if !HEADLESS_BUILD
 void init_NSF_gfx(GraphicsContext* g_ctx, NSF* nsf) {
 #ifdef __ANDROID__
     int offset_x = g_ctx->dest.x, offset_y = g_ctx->dest.y, width = g_ctx->dest.w, height = g_ctx->dest.h;
 #else
     int offset_x = 0, offset_y = 0;
 #endif
-    // pre-compute logarithmic binning boundaries
+    init_real_fft(&nsf->fft, AUDIO_BUFF_SIZE);
+    nsf->song_num = nsf->minutes = nsf->seconds = -1;
+    nsf->silent_frames = 0;
+    memset(nsf->amps, 0, sizeof(nsf->amps));
+    // pre-compute logarithmic binning
+    double bin_width = (double)SAMPLING_FREQUENCY / AUDIO_BUFF_SIZE;
+    memset(nsf->bar_sizes, 0, sizeof(nsf->bar_sizes));
+    for(size_t k = 0; k < SPECTRUM_SIZE; k++) {
+        double freq = k * bin_width;
+        nsf->bin_bars[k] = BAR_COUNT;
+        if(freq < 20 || freq >= 20000)
+            continue;
+        nsf->bin_bars[k] = (log(freq) - log(20)) / (log(20000) - log(20)) * BAR_COUNT;
+        nsf->bar_sizes[nsf->bin_bars[k]]++;
+    }
     for(size_t i = 0; i < BAR_COUNT; i++) {
-        bin_boundaries[i] = exp((log(20000) - log(20))*i/(double)BAR_COUNT) * 20;
+        double center = exp((log(20000) - log(20))*(i + 0.5)/(double)BAR_COUNT) * 20;
+        nsf->bar_fallback[i] = MIN((size_t)(center / bin_width + 0.5), SPECTRUM_SIZE - 1);
     }
-    bin_boundaries[BAR_COUNT] = 20000;
     char buf[256] = {0};
     snprintf(buf, sizeof(buf)/sizeof(buf[0]), "song: %s \nartist: %s \ncopyright: %s", nsf->song_name, nsf->artist, nsf->copyright);
     SDL_Color color = {192, 0x30, 0x0, 0xff};
@@ -608,12 +658,7 @@ void init_NSF_gfx(GraphicsContext* g_ctx, NSF* nsf) {
     SDL_FreeSurface(text_surf);
 }
 
-static float bins[BAR_COUNT] = {0};
-static int amps[BAR_COUNT] = {0};
-
 void render_NSF_graphics(Emulator* emulator, NSF* nsf) {
-    static int song_num = -1, silent_frames = 0;
-    static int minutes = -1, seconds = -1;
     GraphicsContext* g_ctx = &emulator->g_ctx;
 #ifdef __ANDROID__
     int offset_x = g_ctx->dest.x, offset_y = g_ctx->dest.y, width = g_ctx->dest.w, height = g_ctx->dest.h;
@@ -622,58 +667,47 @@ void render_NSF_graphics(Emulator* emulator, NSF* nsf) {
 #endif
 
     APU* apu = &emulator->apu;
-    complx* v = nsf->samples;
     int silent = 1;
-    // convert audio buffer to complex values for FFT
     for(size_t i =0; i < AUDIO_BUFF_SIZE; i++) {
-        v[i].Re = apu->buff[i];
-        v[i].Im = 0;
-        if(silent && apu->buff[i] != 0)
+        if(apu->buff[i] != 0) {
             silent = 0;
+            break;
+        }
     }
     if(silent)
-        silent_frames++;
+        nsf->silent_frames++;
     else
-        silent_frames = 0;
+        nsf->silent_frames = 0;
 
-    if(silent_frames > MAX_SILENCE) {
+    if(nsf->silent_frames > MAX_SILENCE) {
         next_song(emulator, nsf);
-        silent_frames = 0;
+        nsf->silent_frames = 0;
         return;
     }
     // FFT to extract frequency spectrum
-    fft(nsf->samples, AUDIO_BUFF_SIZE, nsf->temp);
+    complx* v = nsf->spectrum;
+    real_fft(&nsf->fft, apu->buff, v);
 
     // Place frequencies into their respective frequency bins
-    double end = bin_boundaries[0], step = 20000.0f / AUDIO_BUFF_SIZE / 2, index = 0;
-    size_t j = step/20;
+    memset(nsf->bins, 0, sizeof(nsf->bins));
+    for(size_t k = 0; k < SPECTRUM_SIZE; k++) {
+        if(nsf->bin_bars[k] < BAR_COUNT)
+            nsf->bins[nsf->bin_bars[k]] += sqrtf(v[k].Re * v[k].Re + v[k].Im * v[k].Im);
+    }
     for(size_t i = 0; i < BAR_COUNT; i++) {
-        double total = 0;
-        size_t bin_count = 0;
-        while(index < end) {
-            total+=sqrt(v[j].Re * v[j].Re + v[j].Im * v[j].Im);
-            index += step;
-            j++;
-            bin_count++;
-        }
-        end = bin_boundaries[i + 1];
-        bins[i] = 0;
-        if(!bin_count) {
-            // distribute to empty bins for better visual effect
-            int target = i > 0? i - 1 : 0;
-            bins[i] = bins[target] / 2;
-            if(target != i)
-                bins[target] /= 2;
+        if(nsf->bar_sizes[i]) {
+            nsf->bins[i] /= nsf->bar_sizes[i];
         } else {
-            bins[i] = total / bin_count;
+            complx* c = &v[nsf->bar_fallback[i]];
+            nsf->bins[i] = sqrtf(c->Re * c->Re + c->Im * c->Im);
         }
     }
 
     // compute normalization factor for spectrum values for better visualization
     float min_v = FLT_MAX, max_v = FLT_MIN;
     for(size_t i = 0; i < BAR_COUNT; i++) {
-        min_v = MIN(min_v, bins[i]);
-        max_v = MAX(max_v, bins[i]);
+        min_v = MIN(min_v, nsf->bins[i]);
+        max_v = MAX(max_v, nsf->bins[i]);
     }
     float factor = 1.0f / (max_v - min_v);
 
@@ -681,18 +715,18 @@ void render_NSF_graphics(Emulator* emulator, NSF* nsf) {
     SDL_Rect dest;
     int max_bar_h = 0.4f * height, min_bar_h = 0.02f * height, bar_step = min_bar_h / 2;
     for(int i = 0; i < BAR_COUNT; i++) {
-        int amp = factor * bins[i] * max_bar_h;
+        int amp = factor * nsf->bins[i] * max_bar_h;
         // animate the visualization bars
-        if(amp > amps[i]) {
-            amps[i] += bar_step;
+        if(amp > nsf->amps[i]) {
+            nsf->amps[i] += bar_step;
         }else {
-            amps[i] -= bar_step;
+            nsf->amps[i] -= bar_step;
         }
-        amps[i] = amps[i] < min_bar_h ? min_bar_h : amps[i] > max_bar_h ? max_bar_h : amps[i];
-        dest.y = (height - amps[i]) / 2 + offset_y;
+        nsf->amps[i] = nsf->amps[i] < min_bar_h ? min_bar_h : nsf->amps[i] > max_bar_h ? max_bar_h : nsf->amps[i];
+        dest.y = (height - nsf->amps[i]) / 2 + offset_y;
         dest.x = i * width/BAR_COUNT + offset_x;
         dest.w = width/BAR_COUNT - 1;
-        dest.h = amps[i];
+        dest.h = nsf->amps[i];
         SDL_SetRenderDrawColor(
             g_ctx->renderer, i*(g_ctx->width/BAR_COUNT), 0x0,
             g_ctx->width - (i * g_ctx->width/BAR_COUNT), 255);
@@ -702,7 +736,7 @@ void render_NSF_graphics(Emulator* emulator, NSF* nsf) {
 
     int current_song = nsf->current_song == 0 ? 0 : nsf->current_song - 1;
 
-    if(song_num != nsf->current_song) {
+    if(nsf->song_num != nsf->current_song) {
         SDL_DestroyTexture(nsf->song_num_tx);
         char str[32 + MAX_TRACK_NAME_SIZE] = {0};
         SDL_Color color = {0x62, 0x30, 152, 0xff};
@@ -719,7 +753,7 @@ void render_NSF_graphics(Emulator* emulator, NSF* nsf) {
         nsf->song_num_rect.h = text_surf->h;
         nsf->song_num_rect.w = text_surf->w;
         nsf->song_num_rect.x = 10 + offset_x;
-        song_num = nsf->current_song;
+        nsf->song_num = nsf->current_song;
 
         if(nsf->times != NULL) {
             SDL_FreeSurface(text_surf);
@@ -756,7 +790,7 @@ void render_NSF_graphics(Emulator* emulator, NSF* nsf) {
         SDL_SetRenderDrawColor(g_ctx->renderer, 60, 0x30, 192, 0xff);
         SDL_RenderFillRect(g_ctx->renderer, &dest);
 
-        if(cur_min != minutes || cur_sec != seconds) {
+        if(cur_min != nsf->minutes || cur_sec != nsf->seconds) {
             SDL_DestroyTexture(nsf->song_dur_tx);
             char str[12];
             SDL_Color color = {0x0, 0x30, 192, 0xff};
@@ -768,8 +802,8 @@ void render_NSF_graphics(Emulator* emulator, NSF* nsf) {
             nsf->song_dur_rect.x = offset_x + 10;
             nsf->song_dur_rect.y = height - 15 - text_surf->h + offset_y;
             SDL_FreeSurface(text_surf);
-            minutes = cur_min;
-            seconds = cur_sec;
+            nsf->minutes = cur_min;
+            nsf->seconds = cur_sec;
         }
     }
 
@@ -784,9 +818,12 @@ void render_NSF_graphics(Emulator* emulator, NSF* nsf) {
     SDL_RenderPresent(g_ctx->renderer);
 }
 
+#endif
+
 void free_NSF(NSF* nsf) {
     if(nsf == NULL)
         return;
+    free_real_fft(&nsf->fft);
     SDL_DestroyTexture(nsf->song_num_tx);
     SDL_DestroyTexture(nsf->song_info_tx);
     SDL_DestroyTexture(nsf->song_dur_tx);
@@ -57,6 +57,8 @@
 
 #define NSF_SENTINEL_ADDR 0x5FF5
 #define NSF_DEFAULT_TRACK_DUR 180000 // ms
+#define BAR_COUNT 128
+#define SPECTRUM_SIZE (AUDIO_BUFF_SIZE / 2 + 1)
 
 typedef enum NSFFormat{
     NSFE = 1,
@@ -95,8 +97,20 @@ typedef struct NSF {
     SDL_Rect song_dur_rect;
     SDL_Texture* song_dur_max_tx;
     SDL_Rect song_dur_max_rect;
-    complx samples[AUDIO_BUFF_SIZE];
-    complx temp[AUDIO_BUFF_SIZE];
+    RealFFT fft;
+    complx spectrum[SPECTRUM_SIZE];
+    // bar each FFT bin falls into, BAR_COUNT if outside the 20Hz - 20kHz range
+    uint8_t bin_bars[SPECTRUM_SIZE];
+    uint16_t bar_sizes[BAR_COUNT];
+    // bars too narrow to contain any FFT bin show the closest one instead
+    uint16_t bar_fallback[BAR_COUNT];
+    float bins[BAR_COUNT];
+    int amps[BAR_COUNT];
+    // last drawn song and time, -1 forces a redraw
+    int song_num;
+    int minutes;
+    int seconds;
+    int silent_frames;
 } NSF;
 
 void load_nsf(SDL_RWops* file, Mapper* mapper);
@@ -106,5 +120,9 @@ void next_song(struct Emulator* emulator, NSF* nsf);
 void prev_song(struct Emulator* emulator, NSF* nsf);
 void init_song(struct Emulator* emulator, size_t song_number);
 void nsf_jsr(struct Emulator* emulator, uint16_t address);
+void run_NSF_cycles(struct Emulator* emulator, NSF* nsf, size_t cycles);
+uint8_t update_NSF_fade(NSF* nsf, APU* apu);
+#if !HEADLESS_BUILD
 void init_NSF_gfx(GraphicsContext* g_ctx, NSF* nsf);
 void render_NSF_graphics(struct Emulator* emulator, NSF* nsf);
+#endif
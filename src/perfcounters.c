@@ -0,0 +1,120 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+#include "perfcounters.h"
+#include "utils.h"
+
+#if PERF_COUNTERS_SUPPORTED
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+const char* perf_counter_names[PERF_COUNTERS] = {
+    "instructions", "cycles", "branch_misses", "l1d_misses", "llc_misses"
+};
+
+#if PERF_COUNTERS_SUPPORTED
+static int open_counter(uint32_t type, uint64_t config, int group);
+
+
+int open_perf_counters(PerfCounters* counters){
+    static const struct { uint32_t type; uint64_t config; } events[PERF_COUNTERS] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    };
+    memset(counters, 0, sizeof(PerfCounters));
+    counters->group = -1;
+    for(int i = 0; i < PERF_COUNTERS; i++) {
+        counters->slot[i] = -1;
+        counters->fds[i] = open_counter(events[i].type, events[i].config, counters->group);
+        if(counters->fds[i] < 0)
+            continue;
+        if(counters->group < 0)
+            counters->group = counters->fds[i];
+        counters->slot[i] = counters->open++;
+    }
+    if(!counters->open)
+        LOG(WARN, "No hardware counters available, check perf_event_paranoid");
+    else if(counters->open < PERF_COUNTERS)
+        LOG(INFO, "Only %d of %d hardware counters available", counters->open, PERF_COUNTERS);
+    return counters->open;
+}
+
+
+void read_perf_counters(PerfCounters* counters, uint64_t values[PERF_COUNTERS]){
+    // PERF_FORMAT_GROUP: the number of counters followed by their values
+    uint64_t data[PERF_COUNTERS + 1] = {0};
+    memset(values, 0, PERF_COUNTERS * sizeof(uint64_t));
+    if(!counters->open || read(counters->group, data, sizeof(data)) < (ssize_t)sizeof(uint64_t))
+        return;
+    for(int i = 0; i < PERF_COUNTERS; i++) {
+        if(counters->slot[i] >= 0 && (uint64_t)counters->slot[i] < data[0])
+            values[i] = data[1 + counters->slot[i]];
+    }
+}
+
+
+void close_perf_counters(PerfCounters* counters){
+    for(int i = 0; i < PERF_COUNTERS; i++) {
+        if(counters->slot[i] >= 0)
+            close(counters->fds[i]);
+        counters->slot[i] = -1;
+    }
+    counters->open = 0;
+}
+
+
+static int open_counter(uint32_t type, uint64_t config, int group){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // this thread on any CPU
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+#else
+int open_perf_counters(PerfCounters* counters){
+    memset(counters, 0, sizeof(PerfCounters));
+    LOG(WARN, "Hardware counters are only supported on Linux");
+    return 0;
+}
+
+
+void read_perf_counters(PerfCounters* counters, uint64_t values[PERF_COUNTERS]){
+    memset(values, 0, PERF_COUNTERS * sizeof(uint64_t));
+}
+
+
+void close_perf_counters(PerfCounters* counters){
+    counters->open = 0;
+}
+#endif
@@ -0,0 +1,58 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+
+// hardware counters come from perf_event_open, other systems go without
+#ifdef __linux__
+#define PERF_COUNTERS_SUPPORTED 1
+#else
+#define PERF_COUNTERS_SUPPORTED 0
+#endif
+
+typedef enum PerfCounter {
+    PERF_INSTRUCTIONS = 0,
+    PERF_CYCLES,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_COUNTERS
+} PerfCounter;
+
+// Counts user space events of the calling thread as one group so all
+// counters cover the same time. Counters the host does not expose (common
+// in virtual machines) are left out and read as 0.
+typedef struct PerfCounters {
+    int group;
+    int fds[PERF_COUNTERS];
+    // position of each open counter in a group read, -1 if not open
+    int slot[PERF_COUNTERS];
+    int open;
+} PerfCounters;
+
+extern const char* perf_counter_names[PERF_COUNTERS];
+
+// returns the number of counters opened, 0 if none are available
+int open_perf_counters(PerfCounters* counters);
+void read_perf_counters(PerfCounters* counters, uint64_t values[PERF_COUNTERS]);
+void close_perf_counters(PerfCounters* counters);
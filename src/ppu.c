@@ -47,21 +47,23 @@
 #include "mmu.h"
 #include "cpu6502.h"
 #include "emulator.h"
+#include "savestate.h"
 
 static uint16_t render_background(PPU* ppu);
 static uint16_t render_sprites(PPU* ppu, uint16_t bg_addr, uint8_t* back_priority);
-uint32_t nes_palette[64];
-static size_t screen_size;
+static uint8_t sprite_zero_pending(const PPU* ppu, int x);
+static void scanline_hook(PPU* ppu);
 
-void init_ppu(struct Emulator* emulator){
-    to_pixel_format(nes_palette_raw, nes_palette, 64, SDL_PIXELFORMAT_ABGR8888);
-    PPU* ppu = &emulator->ppu;
 #if NAMETABLE_MODE
-    screen_size = sizeof(uint32_t) * VISIBLE_SCANLINES * VISIBLE_DOTS * 4;
+#define SCREEN_SIZE (sizeof(uint32_t) * VISIBLE_SCANLINES * VISIBLE_DOTS * 4)
 #else
-    screen_size = sizeof(uint32_t) * VISIBLE_SCANLINES * VISIBLE_DOTS;
+#define SCREEN_SIZE (sizeof(uint32_t) * VISIBLE_SCANLINES * VISIBLE_DOTS)
 #endif
-    ppu->screen = malloc(screen_size);
+
+void init_ppu(struct Emulator* emulator){
+    PPU* ppu = &emulator->ppu;
+    to_pixel_format(nes_palette_raw, ppu->nes_palette, 64, SDL_PIXELFORMAT_ABGR8888);
+    ppu->screen = malloc(SCREEN_SIZE);
     ppu->emulator = emulator;
     ppu->mapper = &emulator->mapper;
     ppu->scanlines_per_frame = emulator->type == NTSC ? NTSC_SCANLINES_PER_FRAME : PAL_SCANLINES_PER_FRAME;
@@ -72,6 +74,10 @@ void init_ppu(struct Emulator* emulator){
     memset(ppu->OAM, 0, sizeof(ppu->OAM));
     ppu->oam_address = 0;
     ppu->v = 0;
+    ppu->no_render = 0;
+    ppu->grey = NULL;
+    init_dirty_pages(&ppu->V_RAM_dirty, sizeof(ppu->V_RAM));
+    init_dirty_pages(&ppu->OAM_dirty, sizeof(ppu->OAM));
     reset_ppu(ppu);
 }
 
@@ -85,13 +91,80 @@ void reset_ppu(PPU* ppu){
     ppu->frames = 0;
     ppu->OAM_cache_len = 0;
     memset(ppu->OAM_cache, 0, 8);
-    memset(ppu->screen, 0, screen_size);
+    memset(ppu->screen, 0, SCREEN_SIZE);
+    if(ppu->grey != NULL)
+        memset(ppu->grey->pixels, 0, ppu->grey->width * ppu->grey->height);
 }
 
 void exit_ppu(PPU* ppu) {
     if(ppu->screen != NULL) {
         free(ppu->screen);
     }
+    set_grey_output(ppu, 0, 0);
+}
+
+int set_grey_output(PPU* ppu, uint16_t width, uint16_t height){
+    if(ppu->grey != NULL) {
+        free(ppu->grey->pixels);
+        free(ppu->grey);
+        ppu->grey = NULL;
+    }
+    if(!width || !height)
+        return 0;
+    if(width > VISIBLE_DOTS || height > VISIBLE_SCANLINES) {
+        LOG(ERROR, "Grey output can not be larger than %dx%d", VISIBLE_DOTS, VISIBLE_SCANLINES);
+        return -1;
+    }
+
+    GreyOutput* grey = malloc(sizeof(GreyOutput));
+    grey->width = width;
+    grey->height = height;
+    grey->pixels = calloc(width * height, 1);
+    // sample the centre of the source area each output pixel covers
+    memset(grey->rows, 0xff, sizeof(grey->rows));
+    memset(grey->cols, 0xff, sizeof(grey->cols));
+    for(int i = 0; i < height; i++)
+        grey->rows[(2 * i + 1) * VISIBLE_SCANLINES / (2 * height)] = i;
+    for(int i = 0; i < width; i++)
+        grey->cols[(2 * i + 1) * VISIBLE_DOTS / (2 * width)] = i;
+    for(int i = 0; i < 64; i++) {
+        uint32_t color = nes_palette_raw[i];
+        // BT.601 weights in 8 bit fixed point
+        grey->luma[i] = (77 * ((color >> 16) & 0xff) + 150 * ((color >> 8) & 0xff) + 29 * (color & 0xff)) >> 8;
+    }
+    ppu->grey = grey;
+    return 0;
+}
+
+void serialize_ppu(PPU* ppu, struct StateStream* stream){
+    // the screen buffer is not saved, it is redrawn by the next frame
+    uint8_t OAM_cache_len = ppu->OAM_cache_len;
+    state_size(stream, &ppu->frames);
+    state_pages(stream, ppu->V_RAM, sizeof(ppu->V_RAM), &ppu->V_RAM_dirty);
+    state_pages(stream, ppu->OAM, sizeof(ppu->OAM), &ppu->OAM_dirty);
+    state_bytes(stream, ppu->OAM_cache, sizeof(ppu->OAM_cache));
+    state_bytes(stream, ppu->palette, sizeof(ppu->palette));
+    state_u8(stream, &OAM_cache_len);
+    state_u8(stream, &ppu->ctrl);
+    state_u8(stream, &ppu->mask);
+    state_u8(stream, &ppu->status);
+    state_size(stream, &ppu->dots);
+    state_size(stream, &ppu->scanlines);
+    state_u16(stream, &ppu->v);
+    state_u16(stream, &ppu->t);
+    state_u8(stream, &ppu->x);
+    state_u8(stream, &ppu->w);
+    state_u8(stream, &ppu->oam_address);
+    state_u8(stream, &ppu->buffer);
+    state_u8(stream, &ppu->render);
+    state_u8(stream, &ppu->bus);
+    if(!stream->loading || stream->error)
+        return;
+    if(OAM_cache_len > 8) {
+        stream->error = 1;
+        return;
+    }
+    ppu->OAM_cache_len = OAM_cache_len;
 }
 
 void set_address(PPU* ppu, uint8_t address){
@@ -119,6 +192,7 @@ uint8_t read_oam(PPU* ppu){
 }
 
 void write_oam(PPU* ppu, uint8_t value){
+    mark_dirty(&ppu->OAM_dirty, ppu->oam_address);
     ppu->OAM[ppu->oam_address++] = value;
 }
 
@@ -155,6 +229,7 @@ void write_ppu(PPU* ppu, uint8_t value){
 }
 
 void dma(PPU* ppu, uint8_t address){
+    TIMELINE_INSTANT("OAM DMA");
     Memory* memory = &ppu->emulator->mem;
     uint8_t* ptr = get_ptr(memory, address * 0x100);
     if(ptr == NULL) {
@@ -173,9 +248,12 @@ void dma(PPU* ppu, uint8_t address){
         // last value
         memory->bus = ptr[255];
     }
-    ppu->emulator->cpu.dma_cycles += 513;
+    mark_dirty(&ppu->OAM_dirty, 0);
+    c6502* cpu = &ppu->emulator->cpu;
+    cpu->dma_cycles += 513;
     // skip extra cycle on odd cycle
-    ppu->emulator->cpu.dma_cycles += ppu->emulator->cpu.odd_cycle;
+    cpu->dma_cycles += cpu->odd_cycle;
+    cpu->oam_dma_end = cpu->t_cycles + cpu->dma_cycles;
 }
 
 
@@ -209,7 +287,9 @@ void write_vram(PPU* ppu, uint16_t address, uint8_t value){
         ppu->mapper->write_CHR(ppu->mapper, address, value);
     else if(address < 0x3F00){
         address = (address & 0xefff) - 0x2000;
-        ppu->V_RAM[ppu->mapper->name_table_map[address / 0x400] + (address & 0x3ff)] = value;
+        address = ppu->mapper->name_table_map[address / 0x400] + (address & 0x3ff);
+        ppu->V_RAM[address] = value;
+        mark_dirty(&ppu->V_RAM_dirty, address);
     }
 
     else if(address < 0x4000) {
@@ -244,9 +324,19 @@ void execute_ppu(PPU* ppu){
         if(ppu->dots > 0 && ppu->dots <= VISIBLE_DOTS){
             int x = (int)ppu->dots - 1;
             uint8_t fine_x = ((uint16_t)ppu->x + x) % 8, palette_addr = 0, palette_addr_sp = 0, back_priority = 0;
+            // the first dots of a frame run before the frame loop returns so
+            // scanline 0 is always drawn, otherwise only pixels that can set
+            // sprite zero hit matter
+            uint8_t output = !ppu->no_render || ppu->scanlines == 0;
+            GreyOutput* grey = ppu->grey;
+            // the downscaled frame only needs the pixels it samples
+            if(grey != NULL)
+                output = output && grey->rows[ppu->scanlines] >= 0 && grey->cols[x] >= 0;
+            uint8_t draw = output || sprite_zero_pending(ppu, x);
 
             if(ppu->mask & SHOW_BG){
-                palette_addr = render_background(ppu);
+                if(draw)
+                    palette_addr = render_background(ppu);
                 if(fine_x == 7) {
                     if ((ppu->v & COARSE_X) == 31) {
                         ppu->v &= ~COARSE_X;
@@ -257,14 +347,19 @@ void execute_ppu(PPU* ppu){
                         ppu->v++;
                 }
             }
-            if(ppu->mask & SHOW_SPRITE && ((ppu->mask & SHOW_SPRITE_8) || x >=8)){
+            if(draw && ppu->mask & SHOW_SPRITE && ((ppu->mask & SHOW_SPRITE_8) || x >=8)){
                 palette_addr_sp = render_sprites(ppu, palette_addr, &back_priority);
             }
-            if((!palette_addr && palette_addr_sp) || (palette_addr && palette_addr_sp && !back_priority))
-                palette_addr = palette_addr_sp;
-
-            palette_addr = ppu->palette[palette_addr];
-            ppu->screen[ppu->scanlines * VISIBLE_DOTS + ppu->dots - 1] = nes_palette[palette_addr];
+            if(output) {
+                if((!palette_addr && palette_addr_sp) || (palette_addr && palette_addr_sp && !back_priority))
+                    palette_addr = palette_addr_sp;
+
+                palette_addr = ppu->palette[palette_addr];
+                if(grey != NULL)
+                    grey->pixels[grey->rows[ppu->scanlines] * grey->width + grey->cols[x]] = grey->luma[palette_addr & 0x3f];
+                else
+                    ppu->screen[ppu->scanlines * VISIBLE_DOTS + ppu->dots - 1] = ppu->nes_palette[palette_addr];
+            }
         }
         if(ppu->dots == VISIBLE_DOTS + 1 && ppu->mask & SHOW_BG){
             if((ppu->v & FINE_Y) != FINE_Y) {
@@ -295,7 +390,7 @@ void execute_ppu(PPU* ppu){
             ppu->v |= ppu->t & HORIZONTAL_BITS;
         }
         else if(ppu->dots == VISIBLE_DOTS + 4 && ppu->mask & SHOW_SPRITE && ppu->mask & SHOW_BG) {
-            ppu->mapper->on_scanline(ppu->mapper);
+            scanline_hook(ppu);
         }
         else if(ppu->dots == END_DOT && ppu->mask & RENDER_ENABLED){
             memset(ppu->OAM_cache, 0, 8);
@@ -336,7 +431,7 @@ void execute_ppu(PPU* ppu){
             ppu->v |= ppu->t & HORIZONTAL_BITS;
         }
         else if(ppu->dots == VISIBLE_DOTS + 4 && ppu->mask & SHOW_SPRITE && ppu->mask & SHOW_BG) {
-            ppu->mapper->on_scanline(ppu->mapper);
+            scanline_hook(ppu);
         }
         else if(ppu->dots > 280 && ppu->dots <= 304 && (ppu->mask & RENDER_ENABLED)){
             ppu->v &= ~VERTICAL_BITS;
@@ -386,6 +481,26 @@ static uint16_t render_background(PPU* ppu){
     return palette_addr | (((attr >> (((ppu->v >> 4) & 4) | (ppu->v & 2))) & 0x3) << 2);
 }
 
+static uint8_t sprite_zero_pending(const PPU* ppu, int x){
+    // sprite 0 can only be the first entry of the cache and wins over
+    // every other sprite on the pixels it covers
+    if(ppu->status & SPRITE_0_HIT || !ppu->OAM_cache_len || ppu->OAM_cache[0] != 0)
+        return 0;
+    int offset = x - ppu->OAM[3];
+    return offset >= 0 && offset < 8;
+}
+
+static void scanline_hook(PPU* ppu){
+    Profiler* profiler = ppu->emulator->profiler;
+    if(profiler == NULL) {
+        ppu->mapper->on_scanline(ppu->mapper);
+        return;
+    }
+    uint64_t start = profile_ticks();
+    ppu->mapper->on_scanline(ppu->mapper);
+    profile_add(profiler, PROF_MAPPER, profile_ticks() - start);
+}
+
 static uint16_t render_sprites(PPU* restrict ppu, uint16_t bg_addr, uint8_t* restrict back_priority){
     // 4 bytes per sprite
     // byte 0 -> y index
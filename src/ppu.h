@@ -79,12 +79,31 @@ enum{
 };
 
 struct Emulator;
+struct StateStream;
+
+// 8 bit luminance frame downscaled by point sampling, drawn instead of
+// the colour screen when set
+typedef struct GreyOutput {
+    uint8_t* pixels;
+    uint16_t width;
+    uint16_t height;
+    // destination row and column of each sampled scanline and dot, -1 if
+    // the pixel is not sampled
+    int16_t rows[VISIBLE_SCANLINES];
+    int16_t cols[VISIBLE_DOTS];
+    // luminance of each palette entry
+    uint8_t luma[64];
+} GreyOutput;
 
 typedef struct PPU{
     size_t frames;
     uint32_t *screen;
+    // nes_palette_raw in the screen pixel format
+    uint32_t nes_palette[64];
     uint8_t V_RAM[0x1000];
     uint8_t OAM[256];
+    DirtyPages V_RAM_dirty;
+    DirtyPages OAM_dirty;
     uint8_t OAM_cache[8];
     uint8_t palette[0x20];
     uint8_t OAM_cache_len;
@@ -104,6 +123,9 @@ typedef struct PPU{
 
     uint8_t render;
     uint8_t bus;
+    // skip pixel output, only state visible to the game is emulated
+    uint8_t no_render;
+    GreyOutput* grey;
 
     struct Emulator* emulator;
     Mapper* mapper;
@@ -122,12 +144,12 @@ static const uint32_t nes_palette_raw[64] = {
 };
 
 
-extern uint32_t nes_palette[64];
-
-
 void execute_ppu(PPU* ppu);
 void reset_ppu(PPU* ppu);
 void exit_ppu(PPU* ppu);
+// width 0 goes back to the colour screen, returns -1 for sizes over 256x240
+int set_grey_output(PPU* ppu, uint16_t width, uint16_t height);
+void serialize_ppu(PPU* ppu, struct StateStream* stream);
 void init_ppu(struct Emulator* emulator);
 uint8_t read_status(PPU* ppu);
 uint8_t read_ppu(PPU* ppu);
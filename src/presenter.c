@@ -0,0 +1,96 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "presenter.h"
+#include "timeline.h"
+#include "utils.h"
+
+#define FRAME_FRESH 4
+#define BUFFER_INDEX 3
+
+static int present_frames(void* data);
+
+
+static int present_frames(void* data) {
+    Presenter* presenter = data;
+    GraphicsContext* g_ctx = presenter->g_ctx;
+    timeline_thread("presenter");
+    init_renderer(g_ctx);
+
+    for(;;) {
+        SDL_SemWait(presenter->frame_ready);
+        if(!SDL_AtomicGet(&presenter->running))
+            break;
+        // frames published while presenting are collapsed into the newest
+        while(SDL_SemTryWait(presenter->frame_ready) == 0);
+        if(!(SDL_AtomicGet(&presenter->middle) & FRAME_FRESH))
+            continue;
+        presenter->front = SDL_AtomicSet(&presenter->middle, presenter->front) & BUFFER_INDEX;
+        TIMELINE_BEGIN("present");
+        render_graphics(g_ctx, presenter->buffers[presenter->front]);
+        TIMELINE_END("present");
+        presenter->presented++;
+    }
+
+    free_renderer(g_ctx);
+    return 0;
+}
+
+
+void start_presenter(Presenter* presenter, GraphicsContext* g_ctx) {
+    memset(presenter, 0, sizeof(Presenter));
+    presenter->g_ctx = g_ctx;
+    presenter->frame_size = g_ctx->width * g_ctx->height * sizeof(uint32_t);
+    for(int i = 0; i < 3; i++)
+        presenter->buffers[i] = calloc(1, presenter->frame_size);
+    presenter->front = 0;
+    SDL_AtomicSet(&presenter->middle, 1);
+    presenter->back = 2;
+    SDL_AtomicSet(&presenter->running, 1);
+    presenter->frame_ready = SDL_CreateSemaphore(0);
+    presenter->thread = SDL_CreateThread(present_frames, "presenter", presenter);
+    if(presenter->thread == NULL) {
+        LOG(ERROR, "%s", SDL_GetError());
+        quit(EXIT_FAILURE);
+    }
+}
+
+
+void publish_frame(Presenter* presenter, const uint32_t* screen) {
+    memcpy(presenter->buffers[presenter->back], screen, presenter->frame_size);
+    presenter->back = SDL_AtomicSet(&presenter->middle, presenter->back | FRAME_FRESH) & BUFFER_INDEX;
+    presenter->published++;
+    SDL_SemPost(presenter->frame_ready);
+}
+
+
+void stop_presenter(Presenter* presenter) {
+    SDL_AtomicSet(&presenter->running, 0);
+    SDL_SemPost(presenter->frame_ready);
+    SDL_WaitThread(presenter->thread, NULL);
+    SDL_DestroySemaphore(presenter->frame_ready);
+    for(int i = 0; i < 3; i++)
+        free(presenter->buffers[i]);
+    LOG(INFO, "Presented %zu of %zu frames", presenter->presented, presenter->published);
+}
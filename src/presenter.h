@@ -0,0 +1,55 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <stdint.h>
+
+#include "gfx.h"
+
+// Presents frames from a thread of its own so a slow present or
+// compositor hiccup does not hold up emulation and audio. Frames are
+// handed over through a lock free triple buffer: the emulation thread
+// fills the back buffer and swaps it with the middle one, the presenter
+// swaps the middle one with its front buffer whenever it is fresh.
+typedef struct Presenter {
+    SDL_Thread* thread;
+    GraphicsContext* g_ctx;
+    uint32_t* buffers[3];
+    size_t frame_size;
+    // index of the middle buffer, with FRAME_FRESH set until it is taken
+    SDL_atomic_t middle;
+    SDL_atomic_t running;
+    SDL_sem* frame_ready;
+    // owned by the emulation thread
+    int back;
+    size_t published;
+    // owned by the presenter thread
+    int front;
+    size_t presented;
+} Presenter;
+
+// creates the renderer on the new thread, no other thread may use it
+void start_presenter(Presenter* presenter, GraphicsContext* g_ctx);
+void publish_frame(Presenter* presenter, const uint32_t* screen);
+// joins the thread and destroys the renderer
+void stop_presenter(Presenter* presenter);
@@ -0,0 +1,220 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "profiler.h"
+#include "utils.h"
+
+static const char* section_names[PROF_SECTIONS] = {
+    "cpu", "ppu", "apu", "mapper", "audio_queue", "present", "events", "pacing", "frame"
+};
+
+static const char* scope_names[PERF_SCOPES] = {"frame", "emulation"};
+
+static void grow_frames(Profiler* profiler);
+static void percentiles(double* column, size_t count, double out[3]);
+static void write_counters(FILE* out, Profiler* profiler, PerfScope scope, double* column);
+static int compare_double(const void* a, const void* b);
+
+
+void init_profiler(Profiler* profiler, const char* file){
+    memset(profiler, 0, sizeof(Profiler));
+    profiler->file = file;
+    profiler->tick_overhead = UINT64_MAX;
+    for(int i = 0; i < 64; i++) {
+        uint64_t start = profile_ticks();
+        profiler->tick_overhead = MIN(profiler->tick_overhead, profile_ticks() - start);
+    }
+    profiler->start_ns = time_ns();
+    profiler->start_ticks = profile_ticks();
+    profiler->frame_start = profiler->start_ticks;
+}
+
+
+void enable_perf_counters(Profiler* profiler){
+    profiler->use_perf = open_perf_counters(&profiler->perf) > 0;
+}
+
+
+void start_profile_frame(Profiler* profiler){
+    memset(profiler->current, 0, sizeof(profiler->current));
+    if(profiler->use_perf) {
+        memset(profiler->perf_current, 0, sizeof(profiler->perf_current));
+        read_perf_counters(&profiler->perf, profiler->perf_start);
+    }
+    profiler->frame_start = profile_ticks();
+}
+
+
+void end_profile_frame(Profiler* profiler){
+    profiler->current[PROF_FRAME] = profile_ticks() - profiler->frame_start;
+    if(profiler->use_perf)
+        perf_end(profiler, PERF_SCOPE_FRAME, profiler->perf_start);
+    if(profiler->count == profiler->capacity)
+        grow_frames(profiler);
+    for(int i = 0; i < PROF_SECTIONS; i++)
+        profiler->frames[profiler->count][i] = MIN(profiler->current[i], UINT32_MAX);
+    if(profiler->use_perf)
+        memcpy(profiler->perf_frames[profiler->count], profiler->perf_current, sizeof(profiler->perf_current));
+    profiler->count++;
+}
+
+
+void perf_begin(Profiler* profiler, uint64_t start[PERF_COUNTERS]){
+    read_perf_counters(&profiler->perf, start);
+}
+
+
+void perf_end(Profiler* profiler, PerfScope scope, const uint64_t start[PERF_COUNTERS]){
+    uint64_t end[PERF_COUNTERS];
+    read_perf_counters(&profiler->perf, end);
+    for(int i = 0; i < PERF_COUNTERS; i++)
+        profiler->perf_current[scope][i] += end[i] - start[i];
+}
+
+
+void write_profile(Profiler* profiler){
+    uint64_t elapsed_ns = time_ns() - profiler->start_ns;
+    uint64_t elapsed_ticks = profile_ticks() - profiler->start_ticks;
+    double us_per_tick = elapsed_ticks ? (double)elapsed_ns / elapsed_ticks / 1000 : 0;
+
+    FILE* out = fopen(profiler->file, "w");
+    if(out == NULL) {
+        LOG(ERROR, "Could not open profile file %s", profiler->file);
+        return;
+    }
+    fprintf(out, "{\n  \"tick_source\": \"%s\",\n  \"sample_period\": %d,\n  \"frames\": %zu,\n  \"sections\": {\n",
+        PROFILE_TICK_SOURCE, PROFILE_SAMPLE_PERIOD, profiler->count);
+    size_t count = profiler->count;
+    double* column = malloc(MAX(count, 1) * sizeof(double));
+    for(int i = 0; i < PROF_SECTIONS; i++) {
+        double total = 0, stats[3];
+        for(size_t j = 0; j < count; j++) {
+            column[j] = profiler->frames[j][i] * us_per_tick;
+            total += column[j];
+        }
+        percentiles(column, count, stats);
+        fprintf(out, "    \"%s\": {\"mean_us\": %.2f, \"p50_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f}%s\n",
+            section_names[i], count ? total / count : 0, stats[0], stats[1], stats[2],
+            i + 1 < PROF_SECTIONS ? "," : "");
+    }
+    fprintf(out, "  }");
+    if(profiler->use_perf) {
+        fprintf(out, ",\n  \"counters\": {\n");
+        for(int scope = 0; scope < PERF_SCOPES; scope++) {
+            fprintf(out, "    \"%s\": {\n", scope_names[scope]);
+            write_counters(out, profiler, scope, column);
+            fprintf(out, "    }%s\n", scope + 1 < PERF_SCOPES ? "," : "");
+        }
+        fprintf(out, "  }");
+    }
+    fprintf(out, "\n}\n");
+    fclose(out);
+    free(column);
+    LOG(INFO, "Profile of %zu frames written to %s", count, profiler->file);
+}
+
+
+void free_profiler(Profiler* profiler){
+    if(profiler->use_perf)
+        close_perf_counters(&profiler->perf);
+    profiler->use_perf = 0;
+    free(profiler->frames);
+    free(profiler->perf_frames);
+    profiler->frames = NULL;
+    profiler->perf_frames = NULL;
+    profiler->count = profiler->capacity = 0;
+}
+
+
+static void grow_frames(Profiler* profiler){
+    profiler->capacity = profiler->capacity ? profiler->capacity * 2 : 4096;
+    profiler->frames = realloc(profiler->frames, profiler->capacity * sizeof(*profiler->frames));
+    if(profiler->use_perf)
+        profiler->perf_frames = realloc(profiler->perf_frames, profiler->capacity * sizeof(*profiler->perf_frames));
+    if(profiler->frames == NULL || (profiler->use_perf && profiler->perf_frames == NULL)) {
+        LOG(ERROR, "Failed to allocate profile frames");
+        quit(EXIT_FAILURE);
+    }
+}
+
+
+static void percentiles(double* column, size_t count, double out[3]){
+    // p50, p99 and max, sorts the column
+    if(!count) {
+        out[0] = out[1] = out[2] = 0;
+        return;
+    }
+    qsort(column, count, sizeof(double), compare_double);
+    out[0] = column[count / 2];
+    out[1] = column[MIN(count * 99 / 100, count - 1)];
+    out[2] = column[count - 1];
+}
+
+
+static void write_counters(FILE* out, Profiler* profiler, PerfScope scope, double* column){
+    size_t count = profiler->count;
+    double totals[PERF_COUNTERS] = {0}, stats[3];
+    for(int i = 0; i < PERF_COUNTERS; i++) {
+        for(size_t j = 0; j < count; j++) {
+            column[j] = profiler->perf_frames[j][scope][i];
+            totals[i] += column[j];
+        }
+        percentiles(column, count, stats);
+        fprintf(out, "      \"%s\": {\"mean\": %.0f, \"p50\": %.0f, \"p99\": %.0f, \"max\": %.0f},\n",
+            perf_counter_names[i], count ? totals[i] / count : 0, stats[0], stats[1], stats[2]);
+    }
+    // per frame rates, the mean is over the whole session
+    for(int i = PERF_CYCLES; i < PERF_COUNTERS; i++) {
+        // instructions per cycle, misses per thousand instructions
+        int ipc = i == PERF_CYCLES;
+        double scale = ipc ? 1 : 1000;
+        for(size_t j = 0; j < count; j++) {
+            const uint64_t* frame = profiler->perf_frames[j][scope];
+            uint64_t num = ipc ? frame[PERF_INSTRUCTIONS] : frame[i];
+            uint64_t den = ipc ? frame[PERF_CYCLES] : frame[PERF_INSTRUCTIONS];
+            column[j] = den ? scale * num / den : 0;
+        }
+        double num = ipc ? totals[PERF_INSTRUCTIONS] : totals[i];
+        double den = ipc ? totals[PERF_CYCLES] : totals[PERF_INSTRUCTIONS];
+        double mean = den ? scale * num / den : 0;
+        percentiles(column, count, stats);
+        if(ipc)
+            fprintf(out, "      \"ipc\"");
+        else
+            fprintf(out, "      \"%s_per_kinstr\"", perf_counter_names[i]);
+        fprintf(out, ": {\"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}%s\n",
+            mean, stats[0], stats[1], stats[2], i + 1 < PERF_COUNTERS ? "," : "");
+        if(scope == PERF_SCOPE_EMULATION && ipc)
+            LOG(INFO, "Emulation IPC: %.3f", mean);
+        else if(scope == PERF_SCOPE_EMULATION)
+            LOG(INFO, "Emulation %s per 1000 instructions: %.3f", perf_counter_names[i], mean);
+    }
+}
+
+
+static int compare_double(const void* a, const void* b){
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,113 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "timers.h"
+#include "perfcounters.h"
+
+// only one in this many CPU cycles has its CPU, PPU and APU steps timed,
+// the emulated frame time is split between them by the sampled shares
+#define PROFILE_SAMPLE_PERIOD 64
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_TICK_SOURCE "rdtsc"
+static inline uint64_t profile_ticks(){
+    return __rdtsc();
+}
+#else
+#define PROFILE_TICK_SOURCE "clock_gettime"
+static inline uint64_t profile_ticks(){
+    return time_ns();
+}
+#endif
+
+typedef enum ProfileSection {
+    PROF_CPU = 0,
+    PROF_PPU,
+    PROF_APU,
+    // mapper scanline hook, also counted in the PPU time
+    PROF_MAPPER,
+    PROF_AUDIO_QUEUE,
+    PROF_PRESENT,
+    PROF_EVENTS,
+    PROF_PACING,
+    // the whole host frame
+    PROF_FRAME,
+    PROF_SECTIONS
+} ProfileSection;
+
+// hardware counters are kept for the host frame and for the emulated
+// frames in it, reading them is a system call so the CPU, PPU and APU
+// steps are not counted apart
+typedef enum PerfScope {
+    PERF_SCOPE_FRAME = 0,
+    PERF_SCOPE_EMULATION,
+    PERF_SCOPES
+} PerfScope;
+
+// Per frame time spent in each part of the run loop, kept for every
+// frame and summarised as percentiles when the session ends.
+typedef struct Profiler {
+    const char* file;
+    // ticks spent in each section since the frame started
+    uint64_t current[PROF_SECTIONS];
+    uint64_t frame_start;
+    // ticks per section for each finished frame
+    uint32_t (*frames)[PROF_SECTIONS];
+    size_t count;
+    size_t capacity;
+    // the tick rate is calibrated against the monotonic clock at the end
+    uint64_t start_ticks;
+    uint64_t start_ns;
+    // cost of reading the clock, taken off short sampled intervals
+    uint64_t tick_overhead;
+    // optional hardware counters, same layout per frame
+    PerfCounters perf;
+    uint8_t use_perf;
+    uint64_t perf_start[PERF_COUNTERS];
+    uint64_t perf_current[PERF_SCOPES][PERF_COUNTERS];
+    uint64_t (*perf_frames)[PERF_SCOPES][PERF_COUNTERS];
+} Profiler;
+
+void init_profiler(Profiler* profiler, const char* file);
+// adds hardware counters to the profile if the system has any
+void enable_perf_counters(Profiler* profiler);
+void start_profile_frame(Profiler* profiler);
+// counts events from perf_begin(start) to now into the scope
+void perf_begin(Profiler* profiler, uint64_t start[PERF_COUNTERS]);
+void perf_end(Profiler* profiler, PerfScope scope, const uint64_t start[PERF_COUNTERS]);
+void end_profile_frame(Profiler* profiler);
+// writes p50/p99/max per section to the profile file
+void write_profile(Profiler* profiler);
+void free_profiler(Profiler* profiler);
+
+static inline uint64_t profile_interval(const Profiler* profiler, uint64_t start, uint64_t end){
+    return end - start > profiler->tick_overhead ? end - start - profiler->tick_overhead : 0;
+}
+
+static inline void profile_add(Profiler* profiler, ProfileSection section, uint64_t ticks){
+    profiler->current[section] += ticks;
+}
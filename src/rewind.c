@@ -0,0 +1,283 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+
+#include "rewind.h"
+#include "emulator.h"
+#include "utils.h"
+
+static size_t encode(const uint8_t* data, const uint8_t* reference, size_t len, uint8_t* out);
+static int decode(const uint8_t* in, size_t in_len, const uint8_t* reference, uint8_t* out, size_t len);
+static void drop_oldest(Rewind* rewind);
+static uint8_t* reserve_entry(Rewind* rewind, size_t size);
+static RewindEntry* entry_at(Rewind* rewind, size_t index);
+
+
+void init_rewind(Rewind* rewind, size_t budget){
+    memset(rewind, 0, sizeof(Rewind));
+    rewind->budget = budget;
+    rewind->ring = malloc(budget);
+    rewind->entries = calloc(REWIND_MAX_ENTRIES, sizeof(RewindEntry));
+    if(rewind->ring == NULL || rewind->entries == NULL) {
+        LOG(ERROR, "Could not allocate rewind buffer");
+        quit(EXIT_FAILURE);
+    }
+    init_state_stream(&rewind->state, 0);
+    // snapshots only copy the pages written since the previous one
+    rewind->state.incremental = 1;
+    rewind->enabled = 1;
+}
+
+
+void free_rewind(Rewind* rewind){
+    if(!rewind->enabled)
+        return;
+    log_rewind_stats(rewind);
+    free(rewind->ring);
+    free(rewind->entries);
+    free(rewind->keyframe);
+    free(rewind->scratch);
+    free_state_stream(&rewind->state);
+    rewind->enabled = 0;
+}
+
+
+void record_rewind(Rewind* rewind, Emulator* emulator){
+    if(!rewind->enabled || ++rewind->frame < REWIND_INTERVAL)
+        return;
+    rewind->frame = 0;
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    if(save_state(emulator, &rewind->state) < 0) {
+        rewind->enabled = 0;
+        return;
+    }
+
+    size_t len = rewind->state.size;
+    if(len != rewind->state_size) {
+        // first snapshot, size the work buffers for this cartridge
+        rewind->state_size = len;
+        rewind->keyframe = realloc(rewind->keyframe, len);
+        // zero runs cost at most two bytes per input byte
+        rewind->scratch = realloc(rewind->scratch, 2 * len + 16);
+        while(rewind->count)
+            drop_oldest(rewind);
+    }
+
+    uint8_t key = !rewind->count || rewind->since_key + 1 >= REWIND_KEYFRAME_INTERVAL;
+    size_t size = encode(rewind->state.data, key ? NULL : rewind->keyframe, len, rewind->scratch);
+    uint8_t* dest = reserve_entry(rewind, size);
+    if(dest != NULL && !key && !rewind->count) {
+        // the keyframe this delta depends on was evicted to make room
+        key = 1;
+        size = encode(rewind->state.data, NULL, len, rewind->scratch);
+        dest = reserve_entry(rewind, size);
+    }
+    if(dest == NULL) {
+        LOG(ERROR, "Rewind budget of %zu bytes is too small for a %zu byte snapshot", rewind->budget, size);
+        rewind->enabled = 0;
+        return;
+    }
+    memcpy(dest, rewind->scratch, size);
+
+    RewindEntry* entry = entry_at(rewind, rewind->count++);
+    entry->offset = dest - rewind->ring;
+    entry->size = size;
+    entry->key = key;
+    if(key) {
+        memcpy(rewind->keyframe, rewind->state.data, len);
+        rewind->since_key = 0;
+    } else {
+        rewind->since_key++;
+    }
+
+    uint64_t ticks = SDL_GetPerformanceCounter() - start;
+    rewind->snapshots++;
+    rewind->raw_bytes += len;
+    rewind->stored_bytes += size;
+    rewind->snapshot_ticks += ticks;
+    if(ticks > rewind->max_snapshot_ticks)
+        rewind->max_snapshot_ticks = ticks;
+}
+
+
+int step_rewind(Rewind* rewind, Emulator* emulator){
+    if(!rewind->enabled || !rewind->count)
+        return 0;
+
+    RewindEntry* entry = entry_at(rewind, rewind->count - 1);
+    StateStream* state = &rewind->state;
+    const uint8_t* reference = entry->key ? NULL : rewind->keyframe;
+    if(decode(rewind->ring + entry->offset, entry->size, reference, state->data, rewind->state_size) < 0) {
+        LOG(ERROR, "Corrupt rewind snapshot");
+        rewind->enabled = 0;
+        return 0;
+    }
+    state->size = rewind->state_size;
+    rewind->count--;
+    rewind->frame = 0;
+    if(load_state(emulator, state) < 0) {
+        rewind->enabled = 0;
+        return 0;
+    }
+
+    if(!entry->key) {
+        rewind->since_key--;
+        return 1;
+    }
+    // deltas recorded from here on refer to the keyframe of the previous group
+    rewind->since_key = 0;
+    for(size_t i = rewind->count; i > 0; i--) {
+        const RewindEntry* prev = entry_at(rewind, i - 1);
+        if(prev->key) {
+            // this step is already loaded, only older ones are lost
+            if(decode(rewind->ring + prev->offset, prev->size, NULL, rewind->keyframe, rewind->state_size) < 0) {
+                LOG(ERROR, "Corrupt rewind snapshot");
+                rewind->enabled = 0;
+            }
+            break;
+        }
+        rewind->since_key++;
+    }
+    return 1;
+}
+
+
+void log_rewind_stats(const Rewind* rewind){
+    if(!rewind->snapshots)
+        return;
+    double ratio = (double)rewind->raw_bytes / rewind->stored_bytes;
+    double avg_us = 1e6 * rewind->snapshot_ticks / rewind->snapshots / SDL_GetPerformanceFrequency();
+    double max_us = 1e6 * rewind->max_snapshot_ticks / SDL_GetPerformanceFrequency();
+    size_t avg_size = rewind->stored_bytes / rewind->snapshots;
+    size_t frames = rewind->count * REWIND_INTERVAL;
+    LOG(INFO, "Rewind budget: %zu KB, %zu snapshots held (%zu frames)", rewind->budget / 1024, rewind->count, frames);
+    LOG(INFO, "Rewind compression: %zu -> %zu bytes per snapshot (%.1f:1)", rewind->state_size, avg_size, ratio);
+    LOG(INFO, "Rewind snapshot cost: %.1f us avg, %.1f us max", avg_us, max_us);
+    // estimated budget for a minute of history at 60 fps
+    LOG(INFO, "Rewind budget for 60s: %zu KB", avg_size * 3600 / REWIND_INTERVAL / 1024 + 1);
+}
+
+
+static RewindEntry* entry_at(Rewind* rewind, size_t index){
+    return &rewind->entries[(rewind->first + index) % REWIND_MAX_ENTRIES];
+}
+
+
+static void drop_oldest(Rewind* rewind){
+    // deltas can't outlive their keyframe so the whole group goes
+    do {
+        rewind->first = (rewind->first + 1) % REWIND_MAX_ENTRIES;
+        rewind->count--;
+    } while(rewind->count && !entry_at(rewind, 0)->key);
+}
+
+
+static uint8_t* reserve_entry(Rewind* rewind, size_t size){
+    if(size > rewind->budget)
+        return NULL;
+    if(rewind->count == REWIND_MAX_ENTRIES)
+        drop_oldest(rewind);
+
+    while(rewind->count) {
+        const RewindEntry* oldest = entry_at(rewind, 0);
+        const RewindEntry* newest = entry_at(rewind, rewind->count - 1);
+        size_t tail = oldest->offset;
+        size_t head = newest->offset + newest->size;
+        if(newest->offset >= tail) {
+            // live data is one block [tail, head)
+            if(rewind->budget - head >= size)
+                return rewind->ring + head;
+            if(tail >= size)
+                return rewind->ring;
+        } else if(tail - head >= size) {
+            // live data wraps, the gap is [head, tail)
+            return rewind->ring + head;
+        }
+        drop_oldest(rewind);
+    }
+    return rewind->ring;
+}
+
+
+static size_t encode(const uint8_t* data, const uint8_t* reference, size_t len, uint8_t* out){
+    // zero runs are stored as a 0 byte followed by the run length in
+    // 7 bit groups, any other byte is stored as is
+    size_t o = 0;
+    size_t i = 0;
+    while(i < len) {
+        uint8_t value = reference ? data[i] ^ reference[i] : data[i];
+        if(value) {
+            out[o++] = value;
+            i++;
+            continue;
+        }
+        size_t run = 0;
+        while(i < len && (reference ? data[i] ^ reference[i] : data[i]) == 0) {
+            run++;
+            i++;
+        }
+        out[o++] = 0;
+        while(run >= 0x80) {
+            out[o++] = (run & 0x7f) | 0x80;
+            run >>= 7;
+        }
+        out[o++] = run;
+    }
+    return o;
+}
+
+
+static int decode(const uint8_t* in, size_t in_len, const uint8_t* reference, uint8_t* out, size_t len){
+    size_t i = 0;
+    size_t o = 0;
+    while(i < in_len) {
+        if(in[i]) {
+            if(o >= len)
+                return -1;
+            out[o] = reference ? in[i] ^ reference[o] : in[i];
+            o++;
+            i++;
+            continue;
+        }
+        i++;
+        size_t run = 0;
+        int shift = 0;
+        while(i < in_len && (in[i] & 0x80)) {
+            run |= (size_t)(in[i++] & 0x7f) << shift;
+            shift += 7;
+        }
+        if(i >= in_len)
+            return -1;
+        run |= (size_t)in[i++] << shift;
+        if(run > len - o)
+            return -1;
+        if(reference)
+            memcpy(out + o, reference + o, run);
+        else
+            memset(out + o, 0, run);
+        o += run;
+    }
+    return o == len ? 0 : -1;
+}
@@ -0,0 +1,73 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "savestate.h"
+
+// memory reserved for compressed snapshots
+#define REWIND_BUDGET (4 * 1024 * 1024)
+// frames between snapshots
+#define REWIND_INTERVAL 2
+// snapshots between keyframes, the rest are XOR deltas against the keyframe
+#define REWIND_KEYFRAME_INTERVAL 30
+#define REWIND_MAX_ENTRIES 8192
+
+struct Emulator;
+
+typedef struct {
+    size_t offset;
+    size_t size;
+    uint8_t key;
+} RewindEntry;
+
+typedef struct Rewind {
+    // compressed snapshots packed back to back, wrapping at the end
+    uint8_t* ring;
+    size_t budget;
+    RewindEntry* entries;
+    size_t first;
+    size_t count;
+    StateStream state;
+    // uncompressed copy of the newest keyframe
+    uint8_t* keyframe;
+    uint8_t* scratch;
+    size_t state_size;
+    size_t since_key;
+    size_t frame;
+    uint8_t enabled;
+
+    // statistics
+    size_t snapshots;
+    uint64_t raw_bytes;
+    uint64_t stored_bytes;
+    uint64_t snapshot_ticks;
+    uint64_t max_snapshot_ticks;
+} Rewind;
+
+void init_rewind(Rewind* rewind, size_t budget);
+void free_rewind(Rewind* rewind);
+void record_rewind(Rewind* rewind, struct Emulator* emulator);
+int step_rewind(Rewind* rewind, struct Emulator* emulator);
+void log_rewind_stats(const Rewind* rewind);
@@ -0,0 +1,531 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "savestate.h"
+#include "emulator.h"
+#include "utils.h"
+
+// initial capacity covers a cartridge with 8KB PRG-RAM and 8KB CHR-RAM
+#define STATE_DEFAULT_CAPACITY 0x8000
+
+typedef struct {
+    char tag[4];
+    void (*serialize)(Emulator*, StateStream*);
+} Chunk;
+
+static void info_chunk(Emulator* emulator, StateStream* stream);
+static void cpu_chunk(Emulator* emulator, StateStream* stream);
+static void ppu_chunk(Emulator* emulator, StateStream* stream);
+static void apu_chunk(Emulator* emulator, StateStream* stream);
+static void ram_chunk(Emulator* emulator, StateStream* stream);
+static void joy_chunk(Emulator* emulator, StateStream* stream);
+static void mapper_chunk(Emulator* emulator, StateStream* stream);
+
+static int reserve(StateStream* stream, size_t len);
+static void track_region(StateRegion* region, DirtyPages* dirty, size_t offset);
+static void state_uint(StateStream* stream, uint64_t* value, size_t width);
+static const Chunk* find_chunk(const uint8_t* tag);
+static uint8_t state_supported(const Emulator* emulator);
+static int walk_chunks(Emulator* emulator, StateStream* stream);
+static int check_state(Emulator* emulator, StateStream* stream);
+
+// INFO must come first so a state from another cartridge is rejected
+// before anything is applied
+static const Chunk chunks[] = {
+    {"INFO", info_chunk},
+    {"CPU ", cpu_chunk},
+    {"PPU ", ppu_chunk},
+    {"APU ", apu_chunk},
+    {"RAM ", ram_chunk},
+    {"JOY ", joy_chunk},
+    {"MAPR", mapper_chunk},
+};
+
+#define CHUNK_COUNT (sizeof(chunks) / sizeof(chunks[0]))
+
+
+void init_state_stream(StateStream* stream, size_t capacity){
+    memset(stream, 0, sizeof(StateStream));
+    stream->capacity = capacity ? capacity : STATE_DEFAULT_CAPACITY;
+    stream->data = malloc(stream->capacity);
+    if(stream->data == NULL){
+        LOG(ERROR, "Could not allocate save state buffer");
+        quit(EXIT_FAILURE);
+    }
+}
+
+
+void free_state_stream(StateStream* stream){
+    free(stream->data);
+    stream->data = NULL;
+    stream->size = stream->capacity = 0;
+}
+
+
+int save_state(Emulator* emulator, StateStream* stream){
+    if(!state_supported(emulator))
+        return -1;
+    stream->loading = 0;
+    stream->error = 0;
+    stream->size = 0;
+    stream->region_index = 0;
+
+    state_bytes(stream, (void*)SAVE_STATE_MAGIC, 4);
+    uint16_t version = SAVE_STATE_VERSION;
+    state_u16(stream, &version);
+
+    for(size_t i = 0; i < CHUNK_COUNT; i++) {
+        // tag and length, the length is patched once the chunk is written
+        state_bytes(stream, (void*)chunks[i].tag, 4);
+        size_t len_pos = stream->size;
+        uint32_t len = 0;
+        state_u32(stream, &len);
+        chunks[i].serialize(emulator, stream);
+        if(stream->error)
+            break;
+        len = stream->size - len_pos - 4;
+        for(int j = 0; j < 4; j++)
+            stream->data[len_pos + j] = len >> (8 * j);
+    }
+
+    // pages skipped by the next incremental save are taken from this one
+    stream->base_valid = stream->incremental && !stream->error;
+    if(stream->error) {
+        LOG(ERROR, "Could not allocate memory for save state");
+        return -1;
+    }
+    return 0;
+}
+
+
+int load_state(Emulator* emulator, StateStream* stream){
+    if(!state_supported(emulator))
+        return -1;
+    stream->loading = 1;
+    stream->error = 0;
+    stream->base_valid = 0;
+    stream->pos = 0;
+    stream->end = stream->size;
+
+    uint8_t magic[4] = {0};
+    uint16_t version = 0;
+    state_bytes(stream, magic, 4);
+    state_u16(stream, &version);
+    if(stream->error || memcmp(magic, SAVE_STATE_MAGIC, 4) != 0) {
+        LOG(ERROR, "Not a save state");
+        return -1;
+    }
+    if(version != SAVE_STATE_VERSION) {
+        LOG(ERROR, "Unsupported save state version %u", version);
+        return -1;
+    }
+
+    // everything is decoded and checked once on a scratch copy so a state
+    // that fails leaves the emulator untouched
+    size_t body = stream->pos;
+    if(check_state(emulator, stream) < 0)
+        return -1;
+    stream->pos = body;
+    stream->region_index = 0;
+    if(walk_chunks(emulator, stream) < 0)
+        return -1;
+    // the loaded regions are tracked from here, the next save builds on them
+    stream->base_valid = stream->incremental;
+    return 0;
+}
+
+
+int save_state_file(Emulator* emulator, const char* path){
+    StateStream stream;
+    init_state_stream(&stream, 0);
+    if(save_state(emulator, &stream) < 0) {
+        free_state_stream(&stream);
+        return -1;
+    }
+
+    FILE* file = fopen(path, "wb");
+    if(file == NULL) {
+        LOG(ERROR, "Could not open '%s' for writing", path);
+        free_state_stream(&stream);
+        return -1;
+    }
+    size_t written = fwrite(stream.data, 1, stream.size, file);
+    fclose(file);
+    uint8_t complete = written == stream.size;
+    free_state_stream(&stream);
+    if(!complete) {
+        LOG(ERROR, "Could not write save state to '%s'", path);
+        return -1;
+    }
+    LOG(INFO, "Saved state to %s", path);
+    return 0;
+}
+
+
+int load_state_file(Emulator* emulator, const char* path){
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) {
+        LOG(ERROR, "Save state '%s' not found", path);
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if(size <= 0) {
+        LOG(ERROR, "Save state '%s' is empty", path);
+        fclose(file);
+        return -1;
+    }
+
+    StateStream stream;
+    init_state_stream(&stream, size);
+    stream.size = fread(stream.data, 1, size, file);
+    fclose(file);
+
+    int result = load_state(emulator, &stream);
+    free_state_stream(&stream);
+    if(result == 0)
+        LOG(INFO, "Loaded state from %s", path);
+    return result;
+}
+
+
+static int walk_chunks(Emulator* emulator, StateStream* stream){
+    uint32_t found = 0;
+    while(stream->pos < stream->size) {
+        uint8_t tag[4];
+        uint32_t len = 0;
+        stream->end = stream->size;
+        state_bytes(stream, tag, 4);
+        state_u32(stream, &len);
+        if(stream->error || len > stream->size - stream->pos) {
+            LOG(ERROR, "Truncated save state");
+            return -1;
+        }
+        stream->end = stream->pos + len;
+
+        const Chunk* chunk = find_chunk(tag);
+        // chunks from newer builds are skipped
+        if(chunk != NULL) {
+            chunk->serialize(emulator, stream);
+            if(stream->error || stream->pos != stream->end) {
+                LOG(ERROR, "Malformed '%.4s' chunk in save state", chunk->tag);
+                return -1;
+            }
+            found |= 1 << (chunk - chunks);
+        }
+        stream->pos = stream->end;
+    }
+    for(size_t i = 0; i < CHUNK_COUNT; i++) {
+        if(!(found & (1 << i))) {
+            LOG(ERROR, "Save state has no '%.4s' chunk", chunks[i].tag);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static int check_state(Emulator* emulator, StateStream* stream){
+    // only the saved components are copied, memory regions are skipped
+    // by state_pages and the extension gets its own buffer
+    Emulator* scratch = malloc(sizeof(Emulator));
+    void* extension = emulator->mapper.extension_size ? malloc(emulator->mapper.extension_size) : NULL;
+    if(scratch == NULL || (emulator->mapper.extension_size && extension == NULL)) {
+        LOG(ERROR, "Could not allocate memory for save state");
+        free(scratch);
+        free(extension);
+        return -1;
+    }
+    scratch->cpu = emulator->cpu;
+    scratch->ppu = emulator->ppu;
+    scratch->apu = emulator->apu;
+    scratch->mem = emulator->mem;
+    scratch->mapper = emulator->mapper;
+    if(extension != NULL) {
+        memcpy(extension, emulator->mapper.extension, emulator->mapper.extension_size);
+        scratch->mapper.extension = extension;
+    }
+
+    stream->checking = 1;
+    int result = walk_chunks(scratch, stream);
+    stream->checking = 0;
+    free(extension);
+    free(scratch);
+    return result;
+}
+
+
+static uint8_t state_supported(const Emulator* emulator){
+    if(emulator->mapper.is_nsf) {
+        LOG(ERROR, "Save states are not supported by the NSF player");
+        return 0;
+    }
+    if(emulator->mapper.genie != NULL) {
+        // the genie swaps mapper functions at runtime which can't be saved
+        LOG(ERROR, "Save states are not supported with Game Genie");
+        return 0;
+    }
+    return 1;
+}
+
+
+static const Chunk* find_chunk(const uint8_t* tag){
+    for(size_t i = 0; i < CHUNK_COUNT; i++) {
+        if(memcmp(chunks[i].tag, tag, 4) == 0)
+            return &chunks[i];
+    }
+    return NULL;
+}
+
+
+static void info_chunk(Emulator* emulator, StateStream* stream){
+    Mapper* mapper = &emulator->mapper;
+    uint16_t mapper_num = mapper->mapper_num;
+    uint16_t PRG_banks = mapper->PRG_banks;
+    uint16_t CHR_banks = mapper->CHR_banks;
+    uint64_t RAM_size = mapper->RAM_size;
+    uint64_t CHR_RAM_size = mapper->CHR_RAM_size;
+    state_u16(stream, &mapper_num);
+    state_u16(stream, &PRG_banks);
+    state_u16(stream, &CHR_banks);
+    state_u64(stream, &RAM_size);
+    state_u64(stream, &CHR_RAM_size);
+
+    if(stream->loading && !stream->error && (mapper_num != mapper->mapper_num
+        || PRG_banks != mapper->PRG_banks || CHR_banks != mapper->CHR_banks
+        || RAM_size != mapper->RAM_size || CHR_RAM_size != mapper->CHR_RAM_size)) {
+        LOG(ERROR, "Save state was made with a different cartridge");
+        stream->error = 1;
+    }
+}
+
+
+static void cpu_chunk(Emulator* emulator, StateStream* stream){
+    serialize_cpu(&emulator->cpu, stream);
+}
+
+
+static void ppu_chunk(Emulator* emulator, StateStream* stream){
+    serialize_ppu(&emulator->ppu, stream);
+}
+
+
+static void apu_chunk(Emulator* emulator, StateStream* stream){
+    serialize_apu(&emulator->apu, stream);
+}
+
+
+static void ram_chunk(Emulator* emulator, StateStream* stream){
+    state_pages(stream, emulator->mem.RAM, RAM_SIZE, &emulator->mem.RAM_dirty);
+    state_u8(stream, &emulator->mem.bus);
+}
+
+
+static void joy_chunk(Emulator* emulator, StateStream* stream){
+    serialize_joypad(&emulator->mem.joy1, stream);
+    serialize_joypad(&emulator->mem.joy2, stream);
+}
+
+
+static void mapper_chunk(Emulator* emulator, StateStream* stream){
+    serialize_mapper(&emulator->mapper, stream);
+}
+
+
+static int reserve(StateStream* stream, size_t len){
+    if(stream->size + len <= stream->capacity)
+        return 0;
+    size_t capacity = stream->capacity ? stream->capacity : STATE_DEFAULT_CAPACITY;
+    while(capacity < stream->size + len)
+        capacity *= 2;
+    uint8_t* data = realloc(stream->data, capacity);
+    if(data == NULL)
+        return -1;
+    stream->data = data;
+    stream->capacity = capacity;
+    return 0;
+}
+
+
+void state_bytes(StateStream* stream, void* data, size_t len){
+    if(stream->error)
+        return;
+    if(stream->loading) {
+        if(len > stream->end - stream->pos) {
+            stream->error = 1;
+            return;
+        }
+        memcpy(data, stream->data + stream->pos, len);
+        stream->pos += len;
+        return;
+    }
+    if(reserve(stream, len) < 0) {
+        stream->error = 1;
+        return;
+    }
+    memcpy(stream->data + stream->size, data, len);
+    stream->size += len;
+}
+
+
+void state_pages(StateStream* stream, uint8_t* data, size_t len, DirtyPages* dirty){
+    if(stream->error)
+        return;
+    if(stream->checking) {
+        // any contents are valid, the scratch copy shares the live buffers
+        if(len > stream->end - stream->pos)
+            stream->error = 1;
+        else
+            stream->pos += len;
+        return;
+    }
+    StateRegion* region = NULL;
+    if(stream->incremental && stream->region_index < STATE_MAX_REGIONS)
+        region = &stream->regions[stream->region_index++];
+
+    if(stream->loading) {
+        if(len > stream->end - stream->pos) {
+            stream->error = 1;
+            return;
+        }
+        // only pages that change are stamped, other streams still hold the rest
+        const uint8_t* in = stream->data + stream->pos;
+        for(size_t offset = 0; offset < len; offset += DIRTY_PAGE_SIZE) {
+            size_t size = len - offset < DIRTY_PAGE_SIZE ? len - offset : DIRTY_PAGE_SIZE;
+            if(memcmp(data + offset, in + offset, size) != 0) {
+                memcpy(data + offset, in + offset, size);
+                mark_dirty(dirty, offset);
+            }
+        }
+        if(region != NULL)
+            track_region(region, dirty, stream->pos);
+        stream->pos += len;
+        return;
+    }
+
+    size_t start = stream->size;
+    if(region == NULL || !stream->base_valid || region->dirty != dirty || region->offset != start) {
+        state_bytes(stream, data, len);
+    } else {
+        // same layout as the last save so unchanged pages are already in place
+        if(reserve(stream, len) < 0) {
+            stream->error = 1;
+            return;
+        }
+        uint8_t* out = stream->data + start;
+        for(size_t page = 0; page < dirty->pages; page++) {
+            if(!page_written_since(dirty, page, region->generation))
+                continue;
+            size_t offset = page << DIRTY_PAGE_SHIFT;
+            size_t size = len - offset < DIRTY_PAGE_SIZE ? len - offset : DIRTY_PAGE_SIZE;
+            memcpy(out + offset, data + offset, size);
+        }
+        stream->size += len;
+    }
+    if(region != NULL && !stream->error)
+        track_region(region, dirty, start);
+}
+
+
+static void track_region(StateRegion* region, DirtyPages* dirty, size_t offset){
+    // data matches the region now, later writes get a newer generation
+    region->dirty = dirty;
+    region->offset = offset;
+    region->generation = dirty->generation++;
+}
+
+
+static void state_uint(StateStream* stream, uint64_t* value, size_t width){
+    uint8_t bytes[8];
+    if(!stream->loading) {
+        for(size_t i = 0; i < width; i++)
+            bytes[i] = *value >> (8 * i);
+    }
+    state_bytes(stream, bytes, width);
+    if(stream->loading && !stream->error) {
+        *value = 0;
+        for(size_t i = 0; i < width; i++)
+            *value |= (uint64_t)bytes[i] << (8 * i);
+    }
+}
+
+
+void state_u8(StateStream* stream, uint8_t* value){
+    state_bytes(stream, value, 1);
+}
+
+
+void state_u16(StateStream* stream, uint16_t* value){
+    uint64_t v = *value;
+    state_uint(stream, &v, 2);
+    *value = v;
+}
+
+
+void state_u32(StateStream* stream, uint32_t* value){
+    uint64_t v = *value;
+    state_uint(stream, &v, 4);
+    *value = v;
+}
+
+
+void state_u64(StateStream* stream, uint64_t* value){
+    state_uint(stream, value, 8);
+}
+
+
+void state_size(StateStream* stream, size_t* value){
+    // SIZE_MAX marks unscheduled events, keep it across word sizes
+    uint64_t v = *value == SIZE_MAX ? UINT64_MAX : *value;
+    state_uint(stream, &v, 8);
+    *value = v == UINT64_MAX ? SIZE_MAX : (size_t)v;
+}
+
+
+void state_long(StateStream* stream, long long* value){
+    uint64_t v = (uint64_t)*value;
+    state_uint(stream, &v, 8);
+    *value = (long long)v;
+}
+
+
+void state_ptr(StateStream* stream, uint8_t** ptr, uint8_t* base, size_t size, size_t bank){
+    uint32_t offset = *ptr == NULL ? UINT32_MAX : (uint32_t)(*ptr - base);
+    state_u32(stream, &offset);
+    if(!stream->loading || stream->error)
+        return;
+    if(bank > size)
+        bank = size;
+    if(offset == UINT32_MAX) {
+        // only a pointer this cartridge never sets may be restored unset
+        if(*ptr != NULL)
+            stream->error = 1;
+    } else if(offset > size - bank) {
+        stream->error = 1;
+    } else {
+        *ptr = base + offset;
+    }
+}
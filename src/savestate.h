@@ -0,0 +1,88 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "utils.h"
+
+#define SAVE_STATE_MAGIC "NESS"
+#define SAVE_STATE_VERSION 1
+
+#define STATE_MAX_REGIONS 8
+
+struct Emulator;
+
+// memory region an incremental stream has copied into its data
+typedef struct StateRegion {
+    const DirtyPages* dirty;
+    // where the region starts in data
+    size_t offset;
+    // pages written after this generation differ from data
+    uint32_t generation;
+} StateRegion;
+
+// Byte stream shared by saving and loading so every component describes
+// its state once. Values are stored little endian and pointers as offsets.
+typedef struct StateStream {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+    size_t pos;
+    // read limit of the chunk being loaded
+    size_t end;
+    uint8_t loading;
+    uint8_t error;
+    // only copy pages written since this stream last saved or loaded
+    // them, the rest is already in data. Each stream keeps its own
+    // generations so several can be incremental on one emulator
+    uint8_t incremental;
+    // data holds a complete save with the current layout
+    uint8_t base_valid;
+    // tracked regions in the order they are saved
+    StateRegion regions[STATE_MAX_REGIONS];
+    size_t region_index;
+    // a load into a scratch copy that only decodes and range checks,
+    // memory regions are skipped
+    uint8_t checking;
+} StateStream;
+
+void init_state_stream(StateStream* stream, size_t capacity);
+void free_state_stream(StateStream* stream);
+
+int save_state(struct Emulator* emulator, StateStream* stream);
+int load_state(struct Emulator* emulator, StateStream* stream);
+int save_state_file(struct Emulator* emulator, const char* path);
+int load_state_file(struct Emulator* emulator, const char* path);
+
+void state_bytes(StateStream* stream, void* data, size_t len);
+void state_u8(StateStream* stream, uint8_t* value);
+void state_u16(StateStream* stream, uint16_t* value);
+void state_u32(StateStream* stream, uint32_t* value);
+void state_u64(StateStream* stream, uint64_t* value);
+void state_size(StateStream* stream, size_t* value);
+void state_long(StateStream* stream, long long* value);
+void state_pages(StateStream* stream, uint8_t* data, size_t len, DirtyPages* dirty);
+// bank bytes are read from the pointer, a bank larger than the region
+// only has to start at its beginning. Nothing is stored when loading fails
+void state_ptr(StateStream* stream, uint8_t** ptr, uint8_t* base, size_t size, size_t bank);
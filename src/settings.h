@@ -44,6 +44,47 @@
 
 #include <stdbool.h>
 
+typedef enum PacingMode {
+    // sleep+spin against the exact frame rate, audio rate steered to the queue
+    PACE_TIMER = 0,
+    // block on the audio queue fill level, audio runs at the exact rate
+    PACE_AUDIO,
+    // block in present on display vsync, audio rate steered to the queue
+    PACE_VSYNC,
+} PacingMode;
+
 typedef struct EmulatorSettings {
     bool multiple_controllers_in_one_keyboard;
+    // no window, renderer or audio device is opened, frames and audio
+    // are left in the PPU screen and APU sample buffers
+    bool headless;
+    // frames to run in a headless session
+    uint32_t headless_frames;
+    // frames emulated ahead of the shown frame to hide input lag
+    uint8_t run_ahead;
+    // run ahead on a second emulator instead of restoring the real one
+    bool run_ahead_instance;
+    // present frames from their own thread instead of the emulation loop
+    bool render_thread;
+    // the frame pacer sleeps until this long before a deadline and spins after
+    uint32_t spin_margin_us;
+    // what the interactive loop waits on between frames
+    PacingMode pacing;
+    // fast-forward without holding the key
+    bool fast_forward;
+    // fast-forward speed as a multiple of real time, 0 runs as fast as possible
+    uint16_t fast_forward_speed;
+    // poll input again on the first controller access of each frame
+    bool late_input;
+    // per frame section timings are written here at exit
+    const char* profile_file;
+    // add hardware counters to the profile
+    bool perf_counters;
+    // Chrome trace events are written here at exit
+    const char* trace_file;
+    // input movie recorded from power on or played back
+    const char* record_movie;
+    const char* play_movie;
+    // RAM and screen hash of every frame
+    const char* hash_log;
 } EmulatorSettings;
\ No newline at end of file
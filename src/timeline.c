@@ -0,0 +1,128 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "timeline.h"
+#include "timers.h"
+#include "utils.h"
+
+int timeline_enabled = 0;
+
+static const char* timeline_file;
+static uint64_t timeline_start;
+static TimelineRing* rings;
+static SDL_SpinLock rings_lock;
+static int next_tid = 1;
+static _Thread_local TimelineRing* thread_ring;
+
+static void write_ring(FILE* out, const TimelineRing* ring);
+
+
+void start_timeline(const char* file){
+    timeline_file = file;
+    timeline_start = time_ns();
+    timeline_enabled = 1;
+    LOG(INFO, "Recording trace events to %s", file);
+}
+
+
+void timeline_thread(const char* name){
+    if(!timeline_enabled || thread_ring != NULL)
+        return;
+    TimelineRing* ring = calloc(1, sizeof(TimelineRing));
+    if(ring != NULL)
+        ring->events = malloc(TIMELINE_RING_EVENTS * sizeof(TimelineEvent));
+    if(ring == NULL || ring->events == NULL) {
+        LOG(ERROR, "Failed to allocate trace event ring");
+        quit(EXIT_FAILURE);
+    }
+    ring->thread_name = name;
+    SDL_AtomicLock(&rings_lock);
+    ring->tid = next_tid++;
+    ring->next = rings;
+    rings = ring;
+    SDL_AtomicUnlock(&rings_lock);
+    thread_ring = ring;
+}
+
+
+void timeline_event(const char* name, char phase){
+    if(thread_ring == NULL)
+        timeline_thread("worker");
+    TimelineRing* ring = thread_ring;
+    TimelineEvent* event = &ring->events[ring->count++ & (TIMELINE_RING_EVENTS - 1)];
+    event->ts = time_ns();
+    event->name = name;
+    event->phase = phase;
+}
+
+
+void stop_timeline(){
+    if(!timeline_enabled)
+        return;
+    timeline_enabled = 0;
+    FILE* out = fopen(timeline_file, "w");
+    if(out == NULL)
+        LOG(ERROR, "Could not open trace event file %s", timeline_file);
+    else
+        fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+    size_t events = 0;
+    for(TimelineRing* ring = rings; ring != NULL;) {
+        if(out != NULL)
+            write_ring(out, ring);
+        events += MIN(ring->count, TIMELINE_RING_EVENTS);
+        TimelineRing* next = ring->next;
+        free(ring->events);
+        free(ring);
+        ring = next;
+    }
+    rings = NULL;
+    thread_ring = NULL;
+
+    if(out != NULL) {
+        // closes the array without a trailing comma
+        fprintf(out, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"nes\"}}\n]}\n");
+        fclose(out);
+        LOG(INFO, "Wrote %zu trace events to %s", events, timeline_file);
+    }
+}
+
+
+static void write_ring(FILE* out, const TimelineRing* ring){
+    fprintf(out, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}},\n",
+        ring->tid, ring->thread_name);
+    size_t first = ring->count > TIMELINE_RING_EVENTS ? ring->count - TIMELINE_RING_EVENTS : 0;
+    // ends whose begin was overwritten are dropped
+    int depth = 0;
+    for(size_t i = first; i < ring->count; i++) {
+        const TimelineEvent* event = &ring->events[i & (TIMELINE_RING_EVENTS - 1)];
+        if(event->phase == 'E' && depth == 0)
+            continue;
+        depth += event->phase == 'B' ? 1 : event->phase == 'E' ? -1 : 0;
+        fprintf(out, "{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d%s},\n",
+            event->name, event->phase, (double)(event->ts - timeline_start) / 1000, ring->tid,
+            event->phase == 'i' ? ", \"s\": \"t\"" : "");
+    }
+}
@@ -0,0 +1,63 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// events kept per thread, the oldest are overwritten once it is full
+#define TIMELINE_RING_EVENTS (1 << 19)
+// scanlines covered by one span inside an emulated frame
+#define TIMELINE_SCANLINE_BATCH 32
+
+// Records begin/end spans and instant events into a ring per thread and
+// writes them in Chrome trace event format (chrome://tracing, Perfetto)
+// when stopped. Each ring has a single writer, its own thread, and is
+// only read after every traced thread has finished.
+typedef struct TimelineEvent {
+    uint64_t ts;
+    const char* name;
+    char phase;
+} TimelineEvent;
+
+typedef struct TimelineRing {
+    TimelineEvent* events;
+    // events ever written, the ring holds the newest ones
+    size_t count;
+    const char* thread_name;
+    int tid;
+    struct TimelineRing* next;
+} TimelineRing;
+
+// checked before every event so a disabled timeline costs one branch
+extern int timeline_enabled;
+
+void start_timeline(const char* file);
+// names the calling thread, threads that never call it are "worker"
+void timeline_thread(const char* name);
+void timeline_event(const char* name, char phase);
+// writes the file, every traced thread must have stopped
+void stop_timeline();
+
+#define TIMELINE_BEGIN(name) do { if(timeline_enabled) timeline_event(name, 'B'); } while(0)
+#define TIMELINE_END(name) do { if(timeline_enabled) timeline_event(name, 'E'); } while(0)
+#define TIMELINE_INSTANT(name) do { if(timeline_enabled) timeline_event(name, 'i'); } while(0)
@@ -41,6 +41,7 @@
 
 
 #include "timers.h"
+#include <string.h>
 
 #define G 1000000000L
 #define M 1000000L
@@ -59,6 +60,8 @@ static int timerPeriod = 0;
 
 static void set_resolution();
 static void reset_resolution();
+static void sleep_until(uint64_t deadline);
+static void start_pacing();
 
 void init_timer(Timer* timer, uint64_t sweep){
     Timer_t* t = calloc(1, sizeof(Timer_t));
@@ -100,17 +103,6 @@ void mark_end(Timer* timer){
     t->diff.QuadPart /= t->frequency.QuadPart;
 }
 
-int adjusted_wait(Timer* timer){
-    Timer_t* t = timer->timer;
-    int64_t req_ms = t->period_ms - t->diff.QuadPart;
-    if(req_ms < SLEEP_RESOLUTION_MS){
-        return 0;
-    }
-    Sleep(req_ms);
-    return 0;
-}
-
-
 int wait(uint64_t period_ms){
     Sleep(period_ms);
     return 0;
@@ -128,6 +120,26 @@ void release_timer(Timer* timer){
         free(timer->timer);
 }
 
+uint64_t time_ns(){
+    static LARGE_INTEGER frequency;
+    if(!frequency.QuadPart)
+        QueryPerformanceFrequency(&frequency);
+    LARGE_INTEGER count;
+    QueryPerformanceCounter(&count);
+    // split to keep count * G from overflowing
+    return (count.QuadPart / frequency.QuadPart) * G + (count.QuadPart % frequency.QuadPart) * G / frequency.QuadPart;
+}
+
+static void sleep_until(uint64_t deadline){
+    int64_t req_ms = (int64_t)(deadline - time_ns()) / M;
+    if(req_ms >= SLEEP_RESOLUTION_MS)
+        Sleep(req_ms);
+}
+
+static void start_pacing(){
+    set_resolution();
+}
+
 static void set_resolution(){
     // set only once
     if(!timerPeriod) {
@@ -146,6 +158,7 @@ static void reset_resolution(){
 
 #else // linux
 #include <unistd.h>
+#include <errno.h>
 #include "time.h"
 
 
@@ -156,6 +169,8 @@ typedef struct Timer_t {
 } Timer_t;
 
 static inline void timespec_diff(struct timespec *a, struct timespec *b, struct timespec *result);
+static void sleep_until(uint64_t deadline);
+static void start_pacing();
 
 void init_timer(Timer* timer, uint64_t period){
     Timer_t* t = calloc(1, sizeof(Timer_t));
@@ -180,20 +195,6 @@ void mark_end(Timer* timer){
     timespec_diff(&end, &t->start, &t->diff);
 }
 
-int adjusted_wait(Timer* timer){
-    Timer_t* t = timer->timer;
-    int64_t req_period_ns = (int64_t)(t->period_ns - (t->diff.tv_sec * G + t->diff.tv_nsec));
-    if(req_period_ns <= t->clock_res)
-        return 0;
-
-    struct timespec req = {
-            .tv_sec=req_period_ns / G,
-            .tv_nsec=req_period_ns % G
-    };
-    return clock_nanosleep(CLOCK_MONOTONIC, 0, &req, NULL);
-}
-
-
 int wait(uint64_t period_ms){
     int64_t req_period_ns = (int64_t)period_ms * M;
     struct timespec req = {
@@ -216,6 +217,23 @@ void release_timer(Timer* timer){
 }
 
 
+uint64_t time_ns(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * G + now.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline){
+    struct timespec req = {
+        .tv_sec=deadline / G,
+        .tv_nsec=deadline % G
+    };
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &req, NULL) == EINTR);
+}
+
+static void start_pacing(){
+}
+
 static inline void timespec_diff(struct timespec *a, struct timespec *b, struct timespec *result) {
     result->tv_sec  = a->tv_sec  - b->tv_sec;
     result->tv_nsec = a->tv_nsec - b->tv_nsec;
@@ -225,4 +243,78 @@ static inline void timespec_diff(struct timespec *a, struct timespec *b, struct
     }
 }
 
-#endif // linux
\ No newline at end of file
+#endif // linux
+
+
+void init_pacer(Pacer* pacer, uint64_t period_num, uint64_t period_den, uint64_t spin_margin_us){
+    memset(pacer, 0, sizeof(Pacer));
+    pacer->period_ns = period_num / period_den;
+    pacer->period_rem = period_num % period_den;
+    pacer->period_den = period_den;
+    pacer->spin_margin_ns = spin_margin_us * 1000;
+}
+
+
+void pace_frame(Pacer* pacer){
+    uint64_t now = time_ns();
+    // first frame, a pause or a frame that overran a whole period:
+    // start a new schedule instead of rushing to catch up
+    if(!pacer->deadline || now > pacer->deadline + pacer->period_ns) {
+        if(pacer->deadline)
+            pacer->resyncs++;
+        start_pacing();
+        pacer->deadline = now;
+        pacer->last = 0;
+    }
+    pacer->deadline += pacer->period_ns;
+    pacer->rem_acc += pacer->period_rem;
+    if(pacer->rem_acc >= pacer->period_den) {
+        pacer->rem_acc -= pacer->period_den;
+        pacer->deadline++;
+    }
+
+    if(pacer->deadline > now + pacer->spin_margin_ns)
+        sleep_until(pacer->deadline - pacer->spin_margin_ns);
+    while((now = time_ns()) < pacer->deadline);
+
+    if(pacer->last) {
+        int64_t error = (int64_t)(now - pacer->last) - (int64_t)pacer->period_ns;
+        int64_t bucket = PACER_BUCKETS / 2 + (error + (error < 0 ? -PACER_BUCKET_NS : PACER_BUCKET_NS) / 2) / PACER_BUCKET_NS;
+        pacer->histogram[MAX(0, MIN(PACER_BUCKETS - 1, bucket))]++;
+        pacer->abs_error += error < 0 ? -error : error;
+        pacer->max_error = MAX(pacer->max_error, error < 0 ? -error : error);
+        pacer->frames++;
+    }
+    pacer->last = now;
+}
+
+
+void report_pacer(const Pacer* pacer){
+    if(!pacer->frames)
+        return;
+    LOG(INFO, "Frame time error: %.1f us avg, %.1f us max over %zu frames, %zu resyncs",
+        (double)pacer->abs_error / pacer->frames / 1000, (double)pacer->max_error / 1000,
+        pacer->frames, pacer->resyncs);
+    for(int i = 0; i < PACER_BUCKETS; i++) {
+        if(!pacer->histogram[i])
+            continue;
+        const char* edge = i == 0 ? "<=" : i == PACER_BUCKETS - 1 ? ">=" : "  ";
+        LOG(INFO, "  %s%+5.1f ms %6.2f%%", edge, (i - PACER_BUCKETS / 2) * PACER_BUCKET_NS / 1e6,
+            100.0 * pacer->histogram[i] / pacer->frames);
+    }
+}
+
+
+void add_latency(LatencyStat* stat, uint64_t ns){
+    stat->total_ns += ns;
+    stat->max_ns = MAX(stat->max_ns, ns);
+    stat->count++;
+}
+
+
+void report_latency(const LatencyStat* stat, const char* name){
+    if(!stat->count)
+        return;
+    LOG(INFO, "%s: %.2f ms avg, %.2f ms max", name,
+        (double)stat->total_ns / stat->count / M, (double)stat->max_ns / M);
+}
@@ -49,14 +49,57 @@ typedef struct Timer{
     void* timer;
 } Timer;
 
+#ifdef _WIN
+// Sleep() wakes up to a scheduler tick late even at 1 ms resolution
+#define DEFAULT_SPIN_MARGIN_US 2000
+#else
+#define DEFAULT_SPIN_MARGIN_US 500
+#endif
+// frame time error histogram, 100 us buckets centred on the period
+#define PACER_BUCKETS 41
+#define PACER_BUCKET_NS 100000
+
+// Paces frames against absolute deadlines: sleeps until spin_margin before
+// the deadline and spins on the monotonic clock for the rest. The period
+// is kept as an exact fraction so deadlines never drift.
+typedef struct Pacer {
+    uint64_t period_ns;
+    // period remainder, period_rem / period_den ns
+    uint64_t period_rem;
+    uint64_t period_den;
+    uint64_t rem_acc;
+    uint64_t spin_margin_ns;
+    uint64_t deadline;
+    // when the last frame was released, 0 after a resync
+    uint64_t last;
+    size_t histogram[PACER_BUCKETS];
+    size_t frames;
+    size_t resyncs;
+    int64_t max_error;
+    uint64_t abs_error;
+} Pacer;
+
+typedef struct LatencyStat {
+    uint64_t total_ns;
+    uint64_t max_ns;
+    size_t count;
+} LatencyStat;
+
 
 void init_timer(Timer* timer, uint64_t period);
 void mark_start(Timer* timer);
 void mark_end(Timer* timer);
-int adjusted_wait(Timer* timer);
 int wait(uint64_t period_ms);
 double get_diff_ms(Timer* timer);
 void release_timer(Timer* timer);
+// monotonic clock in ns
+uint64_t time_ns();
+void add_latency(LatencyStat* stat, uint64_t ns);
+void report_latency(const LatencyStat* stat, const char* name);
+// period_num / period_den ns per frame
+void init_pacer(Pacer* pacer, uint64_t period_num, uint64_t period_den, uint64_t spin_margin_us);
+void pace_frame(Pacer* pacer);
+void report_pacer(const Pacer* pacer);
 
 #ifdef _WIN
 void toggle_timer_resolution();
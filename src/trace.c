@@ -48,11 +48,10 @@
 static void get_opcode(char* out, Opcode opcode);
 static int is_official(uint8_t op_hex, Opcode opcode);
 
-void print_cpu_trace(const c6502* ctx){
-    static uint64_t traces = 0;
+void print_cpu_trace(c6502* ctx){
 #if TRACER == 1
     // for use with the golden log
-    if(traces >= 8991 && !PROFILE)
+    if(ctx->traces >= 8991 && !PROFILE)
         quit(1);
 #endif
     char opcode_str[4], address_str[28], opcode_hex_str[9];
@@ -196,7 +195,7 @@ void print_cpu_trace(const c6502* ctx){
         ctx->sp,
         ctx->t_cycles + 6
     );
-    traces++;
+    ctx->traces++;
 }
 
 static void get_opcode(char* out, Opcode opcode){
@@ -216,30 +216,81 @@ void to_pixel_format(const uint32_t* restrict in, uint32_t* restrict out, size_t
     }
 }
 
-void fft(complx *v, int n, complx *tmp) {
-    if(n <= 1)
-        return;
-    /* otherwise, do nothing and return */
-    int k, m;
-    complx z, w, *vo, *ve;
-    ve = tmp;
-    vo = tmp + n / 2;
-    for (k = 0; k < n / 2; k++) {
-        ve[k] = v[2 * k];
-        vo[k] = v[2 * k + 1];
+void init_real_fft(RealFFT* fft, size_t n) {
+    size_t m = n / 2, bits = 0;
+    fft->n = n;
+    fft->twiddle = malloc(m * sizeof(complx));
+    fft->bit_rev = malloc(m * sizeof(size_t));
+    fft->window = malloc(n * sizeof(real));
+    fft->buf = malloc(m * sizeof(complx));
+
+    while(((size_t)1 << bits) < m)
+        bits++;
+    for(size_t i = 0; i < m; i++) {
+        fft->twiddle[i].Re = cos(2 * PI * i / (double) n);
+        fft->twiddle[i].Im = -sin(2 * PI * i / (double) n);
+        size_t rev = 0;
+        for(size_t j = 0; j < bits; j++)
+            rev |= ((i >> j) & 1) << (bits - 1 - j);
+        fft->bit_rev[i] = rev;
+    }
+    for(size_t i = 0; i < n; i++)
+        fft->window[i] = 0.5 - 0.5 * cos(2 * PI * i / (double) (n - 1));
+}
+
+void real_fft(RealFFT* fft, const int16_t* in, complx* out) {
+    // windowed n point real FFT computed as an n/2 point complex FFT of the
+    // even/odd samples packed as Re/Im, out receives the n/2 + 1 unique bins
+    size_t n = fft->n, m = n / 2;
+    complx* z = fft->buf;
+    const complx* tw = fft->twiddle;
+
+    for(size_t i = 0; i < m; i++) {
+        complx* dst = &z[fft->bit_rev[i]];
+        dst->Re = in[2 * i] * fft->window[2 * i];
+        dst->Im = in[2 * i + 1] * fft->window[2 * i + 1];
     }
-    fft(ve, n / 2, v); /* FFT on even-indexed elements of v[] */
-    fft(vo, n / 2, v); /* FFT on odd-indexed elements of v[] */
-    for (m = 0; m < n / 2; m++) {
-        w.Re = cos(2 * PI * m / (double) n);
-        w.Im = -sin(2 * PI * m / (double) n);
-        z.Re = w.Re * vo[m].Re - w.Im * vo[m].Im; /* Re(w*vo[m]) */
-        z.Im = w.Re * vo[m].Im + w.Im * vo[m].Re; /* Im(w*vo[m]) */
-        v[m].Re = ve[m].Re + z.Re;
-        v[m].Im = ve[m].Im + z.Im;
-        v[m + n / 2].Re = ve[m].Re - z.Re;
-        v[m + n / 2].Im = ve[m].Im - z.Im;
+
+    // iterative radix-2 butterflies, e^(-2*pi*i*j/len) == twiddle[j * n/len]
+    for(size_t len = 2; len <= m; len <<= 1) {
+        size_t half = len / 2, stride = n / len;
+        for(size_t i = 0; i < m; i += len) {
+            for(size_t j = 0; j < half; j++) {
+                complx w = tw[j * stride], a = z[i + j], b = z[i + j + half], t;
+                t.Re = w.Re * b.Re - w.Im * b.Im;
+                t.Im = w.Re * b.Im + w.Im * b.Re;
+                z[i + j].Re = a.Re + t.Re;
+                z[i + j].Im = a.Im + t.Im;
+                z[i + j + half].Re = a.Re - t.Re;
+                z[i + j + half].Im = a.Im - t.Im;
+            }
+        }
     }
+
+    // untangle the even and odd spectra
+    out[0].Re = z[0].Re + z[0].Im;
+    out[0].Im = 0;
+    out[m].Re = z[0].Re - z[0].Im;
+    out[m].Im = 0;
+    for(size_t k = 1; k < m; k++) {
+        complx a = z[k], b = z[m - k], e, o, t;
+        e.Re = 0.5f * (a.Re + b.Re);
+        e.Im = 0.5f * (a.Im - b.Im);
+        o.Re = 0.5f * (a.Re - b.Re);
+        o.Im = 0.5f * (a.Im + b.Im);
+        t.Re = tw[k].Re * o.Re - tw[k].Im * o.Im;
+        t.Im = tw[k].Re * o.Im + tw[k].Im * o.Re;
+        out[k].Re = e.Re + t.Im;
+        out[k].Im = e.Im - t.Re;
+    }
+}
+
+void free_real_fft(RealFFT* fft) {
+    free(fft->twiddle);
+    free(fft->bit_rev);
+    free(fft->window);
+    free(fft->buf);
+    memset(fft, 0, sizeof(RealFFT));
 }
 
 char *get_file_name(char *path) {
@@ -253,6 +304,32 @@ char *get_file_name(char *path) {
     return pfile;
 }
 
+void init_dirty_pages(DirtyPages* dirty, size_t size) {
+    dirty->pages = (size + DIRTY_PAGE_SIZE - 1) >> DIRTY_PAGE_SHIFT;
+    if(dirty->pages > DIRTY_MAX_PAGES) {
+        LOG(ERROR, "Memory region of %zu bytes is too large to track", size);
+        quit(EXIT_FAILURE);
+    }
+    // a consumer copies the whole region the first time it sees it
+    dirty->generation = 1;
+    memset(dirty->written, 0, dirty->pages * sizeof(uint32_t));
+}
+
+uint64_t hash_bytes(const void* data, size_t len, uint64_t hash) {
+    // FNV-1a taken a 64 bit word at a time, the tail byte by byte.
+    // the multiply only carries upwards so fold the high half back in
+    const uint8_t* bytes = data;
+    for(; len >= 8; len -= 8, bytes += 8) {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        hash = (hash ^ word) * FNV_PRIME;
+        hash ^= hash >> 32;
+    }
+    for(; len > 0; len--, bytes++)
+        hash = (hash ^ *bytes) * FNV_PRIME;
+    return hash;
+}
+
 uint64_t next_power_of_2(uint64_t num) {
     int64_t power = 1;
     while(power < num)
@@ -52,6 +52,44 @@
 typedef float real;
 typedef struct{real Re; real Im;} complx;
 
+// tables for an n point real input FFT, n a power of 2
+typedef struct {
+    size_t n;
+    // e^(-2*pi*i*k/n) for k < n/2
+    complx* twiddle;
+    size_t* bit_rev;
+    // Hann window
+    real* window;
+    complx* buf;
+} RealFFT;
+
+// generation of the last write to each 256 byte page. A consumer of the
+// changes (incremental snapshots) remembers the generation it last saw
+// and takes a new one, so any number of them can follow the same region
+#define DIRTY_PAGE_SHIFT 8
+#define DIRTY_PAGE_SIZE (1 << DIRTY_PAGE_SHIFT)
+// covers 2MB, the largest RAM a NES 2.0 header can declare
+#define DIRTY_MAX_PAGES 8192
+
+typedef struct {
+    size_t pages;
+    // stamped on every page written from now on
+    uint32_t generation;
+    uint32_t written[DIRTY_MAX_PAGES];
+} DirtyPages;
+
+static inline void mark_dirty(DirtyPages* dirty, size_t offset){
+    dirty->written[offset >> DIRTY_PAGE_SHIFT] = dirty->generation;
+}
+
+static inline uint8_t page_written_since(const DirtyPages* dirty, size_t page, uint32_t generation){
+    return dirty->written[page] > generation;
+}
+
+// seed and multiplier for hash_bytes
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
 #if defined(_WIN32) || defined(_WIN64)
 #define _WIN 1
 #endif
@@ -77,7 +115,17 @@ typedef struct{real Re; real Im;} complx;
 #define PROFILE 0
 #define PROFILE_STOP_FRAME 1
 #define NAMETABLE_MODE 0
+// build without window, renderer, audio device and SDL_ttf (make HEADLESS=1)
+#ifndef HEADLESS_BUILD
+#define HEADLESS_BUILD 0
+#endif
 #define EXIT_PAUSE 0
+// SDL only renders from the main thread on these
+#if defined(__ANDROID__) || defined(__APPLE__)
+#define RENDER_THREAD_SUPPORTED 0
+#else
+#define RENDER_THREAD_SUPPORTED 1
+#endif
 
 enum {
     BIT_7 = 1<<7,
@@ -105,7 +153,11 @@ void TRACE(const char* fmt, ...);
 int SDL_RenderDrawCircle(SDL_Renderer * renderer, int x, int y, int radius);
 int SDL_RenderFillCircle(SDL_Renderer * renderer, int x, int y, int radius);
 void to_pixel_format(const uint32_t* restrict in, uint32_t* restrict out, size_t size, uint32_t format);
-void fft(complx *v, int n, complx *tmp);
+void init_real_fft(RealFFT* fft, size_t n);
+void real_fft(RealFFT* fft, const int16_t* in, complx* out);
+void free_real_fft(RealFFT* fft);
+void init_dirty_pages(DirtyPages* dirty, size_t size);
+uint64_t hash_bytes(const void* data, size_t len, uint64_t hash);
 uint64_t next_power_of_2(uint64_t num);
 char *get_file_name(char *path);
 void quit(int code);
@@ -0,0 +1,280 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libnes.h"
+#include "emulator.h"
+#include "savestate.h"
+#include "utils.h"
+
+typedef struct VecWorker {
+    SDL_Thread* thread;
+    struct NESVecEnv* env;
+    // instances [first, last) belong to this worker
+    int first;
+    int last;
+} VecWorker;
+
+struct NESVecEnv {
+    // all instances in one block, the first owns the ROM the rest share
+    Emulator* emulators;
+    // set when an instance finished and starts over on the next step
+    uint8_t* restart;
+    int count;
+    NESVecConfig config;
+    // bytes per observation
+    size_t frame_size;
+    // power on state every instance restarts from
+    StateStream initial;
+
+    // arguments of the step in progress
+    const uint16_t* inputs;
+    uint8_t* obs;
+    uint8_t* dones;
+
+    // workers[0] is the calling thread
+    VecWorker* workers;
+    int threads;
+    SDL_mutex* lock;
+    SDL_cond* start;
+    SDL_cond* finished;
+    uint32_t generation;
+    int pending;
+    uint8_t exiting;
+};
+
+static void restart_instance(NESVecEnv* env, int index);
+static void step_instance(NESVecEnv* env, int index);
+static const uint8_t* frame_of(Emulator* emulator);
+static int vec_worker(void* data);
+
+
+static void restart_instance(NESVecEnv* env, int index) {
+    // load_state only reads, wrap the shared data so instances can load at once
+    StateStream stream;
+    memset(&stream, 0, sizeof(StateStream));
+    stream.data = env->initial.data;
+    stream.size = stream.capacity = env->initial.size;
+    load_state(&env->emulators[index], &stream);
+    env->restart[index] = 0;
+}
+
+
+static const uint8_t* frame_of(Emulator* emulator) {
+    if(emulator->ppu.grey != NULL)
+        return emulator->ppu.grey->pixels;
+    return (const uint8_t*)emulator->ppu.screen;
+}
+
+
+static void step_instance(NESVecEnv* env, int index) {
+    Emulator* emulator = &env->emulators[index];
+    const NESVecConfig* config = &env->config;
+    if(env->restart[index])
+        restart_instance(env, index);
+    emulator->mem.joy1.status = env->inputs[index] & 0xff;
+
+    size_t size = env->frame_size;
+    uint8_t* out = env->obs + index * size;
+    int frames = config->frame_skip;
+    uint8_t done = 0;
+    uint8_t pooled = 0;
+    for(int i = 0; i < frames && !done; i++) {
+        step_frame(emulator);
+        if(config->max_pool && i == frames - 2) {
+            memcpy(out, frame_of(emulator), size);
+            pooled = 1;
+        }
+        if(config->done_mask)
+            done = (emulator->mem.RAM[config->done_addr] & config->done_mask) == config->done_value;
+    }
+
+    const uint8_t* frame = frame_of(emulator);
+    if(pooled) {
+        for(size_t i = 0; i < size; i++)
+            out[i] = MAX(out[i], frame[i]);
+    } else {
+        memcpy(out, frame, size);
+    }
+
+    if(env->dones != NULL)
+        env->dones[index] = done;
+    env->restart[index] = done;
+}
+
+
+static int vec_worker(void* data) {
+    VecWorker* worker = data;
+    NESVecEnv* env = worker->env;
+    uint32_t generation = 0;
+    for(;;) {
+        SDL_LockMutex(env->lock);
+        while(env->generation == generation && !env->exiting)
+            SDL_CondWait(env->start, env->lock);
+        if(env->exiting) {
+            SDL_UnlockMutex(env->lock);
+            break;
+        }
+        generation = env->generation;
+        SDL_UnlockMutex(env->lock);
+
+        for(int i = worker->first; i < worker->last; i++)
+            step_instance(env, i);
+
+        SDL_LockMutex(env->lock);
+        if(--env->pending == 0)
+            SDL_CondSignal(env->finished);
+        SDL_UnlockMutex(env->lock);
+    }
+    return 0;
+}
+
+
+NESVecEnv* nes_vec_create(const uint8_t* rom, size_t size, int count, const NESVecConfig* config) {
+    if(count < 1)
+        return NULL;
+    NESVecConfig defaults;
+    memset(&defaults, 0, sizeof(NESVecConfig));
+    if(config == NULL)
+        config = &defaults;
+    if(config->done_mask && config->done_addr >= RAM_SIZE) {
+        LOG(ERROR, "done_addr has to be in CPU RAM");
+        return NULL;
+    }
+    uint8_t grey = config->grey_width > 0 && config->grey_height > 0;
+    if(grey && (config->grey_width > NES_WIDTH || config->grey_height > NES_HEIGHT)) {
+        LOG(ERROR, "Grey observations can not be larger than %dx%d", NES_WIDTH, NES_HEIGHT);
+        return NULL;
+    }
+
+    NESVecEnv* env = calloc(1, sizeof(NESVecEnv));
+    env->emulators = calloc(count, sizeof(Emulator));
+    env->restart = calloc(count, 1);
+    env->count = count;
+    env->config = *config;
+    if(env->config.frame_skip < 1)
+        env->config.frame_skip = 1;
+    env->frame_size = grey ? (size_t)config->grey_width * config->grey_height : NES_WIDTH * NES_HEIGHT * sizeof(uint32_t);
+
+    Emulator* first = &env->emulators[0];
+    first->settings.headless = true;
+    if(load_ROM_image(rom, size, &first->mapper) < 0) {
+        free(env->restart);
+        free(env->emulators);
+        free(env);
+        return NULL;
+    }
+    for(int i = 0; i < count; i++) {
+        Emulator* emulator = &env->emulators[i];
+        if(i > 0) {
+            emulator->settings = first->settings;
+            clone_mapper(&emulator->mapper, &first->mapper);
+        }
+        init_emulator_core(emulator);
+        emulator->apu.no_audio = 1;
+        if(grey)
+            set_grey_output(&emulator->ppu, config->grey_width, config->grey_height);
+    }
+    init_state_stream(&env->initial, 0);
+    save_state(first, &env->initial);
+    // clones share the first instance's banks until they load a state
+    for(int i = 1; i < count; i++)
+        restart_instance(env, i);
+
+    int threads = config->threads > 0 ? config->threads : SDL_GetCPUCount();
+    env->threads = threads < 1 ? 1 : threads > count ? count : threads;
+    env->workers = calloc(env->threads, sizeof(VecWorker));
+    env->lock = SDL_CreateMutex();
+    env->start = SDL_CreateCond();
+    env->finished = SDL_CreateCond();
+    for(int i = 0; i < env->threads; i++) {
+        VecWorker* worker = &env->workers[i];
+        worker->env = env;
+        worker->first = (int)((int64_t)count * i / env->threads);
+        worker->last = (int)((int64_t)count * (i + 1) / env->threads);
+        if(i > 0)
+            worker->thread = SDL_CreateThread(vec_worker, "vec_worker", worker);
+    }
+    return env;
+}
+
+
+void nes_vec_destroy(NESVecEnv* env) {
+    if(env == NULL)
+        return;
+    SDL_LockMutex(env->lock);
+    env->exiting = 1;
+    SDL_CondBroadcast(env->start);
+    SDL_UnlockMutex(env->lock);
+    for(int i = 1; i < env->threads; i++)
+        SDL_WaitThread(env->workers[i].thread, NULL);
+    SDL_DestroyCond(env->finished);
+    SDL_DestroyCond(env->start);
+    SDL_DestroyMutex(env->lock);
+    free(env->workers);
+
+    // the clones point into the first instance's ROM, free it last
+    for(int i = env->count - 1; i >= 0; i--)
+        free_emulator(&env->emulators[i]);
+    free_state_stream(&env->initial);
+    free(env->restart);
+    free(env->emulators);
+    free(env);
+}
+
+
+void nes_vec_reset(NESVecEnv* env) {
+    for(int i = 0; i < env->count; i++)
+        restart_instance(env, i);
+}
+
+
+void nes_vec_step(NESVecEnv* env, const uint16_t* inputs, void* obs, uint8_t* dones) {
+    env->inputs = inputs;
+    env->obs = obs;
+    env->dones = dones;
+    if(env->threads > 1) {
+        SDL_LockMutex(env->lock);
+        env->pending = env->threads - 1;
+        env->generation++;
+        SDL_CondBroadcast(env->start);
+        SDL_UnlockMutex(env->lock);
+    }
+
+    VecWorker* worker = &env->workers[0];
+    for(int i = worker->first; i < worker->last; i++)
+        step_instance(env, i);
+
+    if(env->threads > 1) {
+        SDL_LockMutex(env->lock);
+        while(env->pending > 0)
+            SDL_CondWait(env->finished, env->lock);
+        SDL_UnlockMutex(env->lock);
+    }
+}
+
+
+const uint8_t* nes_vec_ram(const NESVecEnv* env, int index) {
+    return env->emulators[index].mem.RAM;
+}
@@ -0,0 +1,391 @@
+/*
+ * NES Emulator
+ * Copyright (C) 2025  filipemd
+ * 
+ * This file is part of NES Emulator.
+ * 
+ * NES Emulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * NES Emulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with NES Emulator.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <SDL2/SDL.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wavexport.h"
+#include "emulator.h"
+#include "nsf.h"
+#include "timers.h"
+#include "utils.h"
+
+#ifdef _WIN
+#include <direct.h>
+#define make_dir(path) _mkdir(path)
+#else
+#define make_dir(path) mkdir(path, 0755)
+#endif
+
+#define WAV_HEADER_SIZE 44
+// samples at or below this amplitude count as silence
+#define SILENCE_LEVEL 16
+// untimed tracks end after this much continuous silence
+#define MAX_SILENCE_MS 3000
+#define MAX_SILENCE_SAMPLES (MAX_SILENCE_MS * (SAMPLING_FREQUENCY / 1000))
+// give up on init routines that never return
+#define INIT_TIMEOUT_MS 5000
+
+typedef struct RenderJob {
+    const char* path;
+    uint8_t track;
+} RenderJob;
+
+typedef struct RenderQueue {
+    RenderJob* jobs;
+    size_t len;
+    size_t cap;
+    char** paths;
+    size_t path_count;
+    SDL_atomic_t next;
+    const char* out_dir;
+} RenderQueue;
+
+typedef struct WavFile {
+    FILE* file;
+    size_t samples;
+} WavFile;
+
+typedef struct RenderWorker {
+    SDL_Thread* thread;
+    RenderQueue* queue;
+    Emulator emulator;
+    // quiet samples are held back until louder audio follows
+    // so trailing silence can be dropped
+    int16_t pending[MAX_SILENCE_SAMPLES];
+    size_t pending_len;
+    size_t tracks;
+    double audio_ms;
+} RenderWorker;
+
+
+static void put_le16(uint8_t* out, uint16_t value) {
+    out[0] = value & 0xff;
+    out[1] = value >> 8;
+}
+
+static void put_le32(uint8_t* out, uint32_t value) {
+    put_le16(out, value & 0xffff);
+    put_le16(out + 2, value >> 16);
+}
+
+static void write_wav_header(FILE* file, size_t samples) {
+    uint32_t data_size = samples * sizeof(int16_t);
+    uint8_t header[WAV_HEADER_SIZE];
+    memcpy(header, "RIFF", 4);
+    put_le32(header + 4, 36 + data_size);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_le32(header + 16, 16);
+    // PCM, mono
+    put_le16(header + 20, 1);
+    put_le16(header + 22, 1);
+    put_le32(header + 24, SAMPLING_FREQUENCY);
+    put_le32(header + 28, SAMPLING_FREQUENCY * sizeof(int16_t));
+    put_le16(header + 32, sizeof(int16_t));
+    put_le16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    put_le32(header + 40, data_size);
+    fwrite(header, 1, WAV_HEADER_SIZE, file);
+}
+
+static void write_samples(WavFile* wav, const int16_t* samples, size_t len) {
+    uint8_t out[AUDIO_BUFF_SIZE * sizeof(int16_t)];
+    while(len > 0) {
+        size_t n = MIN(len, AUDIO_BUFF_SIZE);
+        for(size_t i = 0; i < n; i++)
+            put_le16(out + i * 2, samples[i]);
+        fwrite(out, sizeof(int16_t), n, wav->file);
+        wav->samples += n;
+        samples += n;
+        len -= n;
+    }
+}
+
+static void flush_pending(RenderWorker* worker, WavFile* wav) {
+    write_samples(wav, worker->pending, worker->pending_len);
+    worker->pending_len = 0;
+}
+
+static uint8_t drain_samples(RenderWorker* worker, WavFile* wav, uint8_t stop_on_silence) {
+    // returns 1 if the track should end due to silence
+    APU* apu = &worker->emulator.apu;
+    size_t len = apu->sampler.index;
+    apu->sampler.index = 0;
+    for(size_t i = 0; i < len; i++) {
+        int16_t sample = apu->buff[i];
+        if(sample > SILENCE_LEVEL || sample < -SILENCE_LEVEL) {
+            flush_pending(worker, wav);
+            write_samples(wav, &sample, 1);
+            continue;
+        }
+        worker->pending[worker->pending_len++] = sample;
+        if(worker->pending_len >= MAX_SILENCE_SAMPLES) {
+            if(stop_on_silence)
+                return 1;
+            flush_pending(worker, wav);
+        }
+    }
+    return 0;
+}
+
+static int init_NSF_instance(RenderWorker* worker, const char* path) {
+    Emulator* emulator = &worker->emulator;
+    memset(emulator, 0, sizeof(Emulator));
+    emulator->settings.headless = true;
+
+    if(load_file((char*)path, NULL, NULL, &emulator->mapper) < 0)
+        return -1;
+    emulator->type = emulator->mapper.type;
+    emulator->mapper.emulator = emulator;
+    init_mem(emulator);
+    init_ppu(emulator);
+    init_cpu(emulator);
+    init_APU(emulator);
+    return 0;
+}
+
+static void render_track(RenderWorker* worker, const RenderJob* job) {
+    Emulator* emulator = &worker->emulator;
+    if(init_NSF_instance(worker, job->path) < 0)
+        return;
+
+    NSF* nsf = emulator->mapper.NSF;
+    c6502* cpu = &emulator->cpu;
+    APU* apu = &emulator->apu;
+    double clock = emulator->type == PAL ? PAL_CPU_CLOCK : NTSC_CPU_CLOCK;
+    size_t cycles_per_frame = nsf->speed * clock / 1000000;
+    double ms_per_frame = nsf->speed / 1000.0;
+    // run frames in slices that fit in the APU buffer
+    size_t slice = (AUDIO_BUFF_SIZE / 2) * (size_t)(clock / SAMPLING_FREQUENCY);
+
+    size_t track = job->track - 1;
+    uint8_t timed = nsf->times != NULL && nsf->times[track] >= 0;
+    if(nsf->fade != NULL && nsf->fade[track] < 0)
+        nsf->fade[track] = 0;
+
+    char name[256];
+    strncpy(name, get_file_name((char*)job->path), sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    char* ext = strrchr(name, '.');
+    if(ext != NULL)
+        *ext = '\0';
+    char out_path[512];
+    snprintf(out_path, sizeof(out_path), "%s/%s-%02u.wav", worker->queue->out_dir, name, job->track);
+
+    WavFile wav = {fopen(out_path, "wb"), 0};
+    if(wav.file == NULL) {
+        LOG(ERROR, "Could not create %s", out_path);
+        goto cleanup;
+    }
+    // placeholder until the length is known
+    write_wav_header(wav.file, 0);
+
+    nsf->current_song = job->track;
+    init_song(emulator, job->track);
+    lock_sample_rate(apu, clock);
+    worker->pending_len = 0;
+
+    uint8_t done = 0;
+    size_t frames = 0;
+    while(!done) {
+        if(timed) {
+            if(update_NSF_fade(nsf, apu))
+                break;
+        } else if(nsf->tick >= NSF_DEFAULT_TRACK_DUR) {
+            break;
+        }
+        if(nsf->initializing && frames * ms_per_frame > INIT_TIMEOUT_MS) {
+            LOG(ERROR, "%s track %u: init routine did not return", job->path, job->track);
+            break;
+        }
+
+        if(cpu->pc == NSF_SENTINEL_ADDR)
+            nsf_jsr(emulator, nsf->play_addr);
+
+        for(size_t cycles = 0; cycles < cycles_per_frame && !done; cycles += slice) {
+            run_NSF_cycles(emulator, nsf, MIN(slice, cycles_per_frame - cycles));
+            done = drain_samples(worker, &wav, !timed);
+        }
+
+        if(!nsf->initializing)
+            nsf->tick += ms_per_frame;
+        if(cpu->pc == NSF_SENTINEL_ADDR && nsf->initializing) {
+            nsf->initializing = 0;
+            nsf->tick = 0;
+        }
+        frames++;
+    }
+
+    // keep the fade out of timed tracks, drop trailing silence otherwise
+    if(timed)
+        flush_pending(worker, &wav);
+    worker->pending_len = 0;
+
+    fseek(wav.file, 0, SEEK_SET);
+    write_wav_header(wav.file, wav.samples);
+    fclose(wav.file);
+
+    double duration = wav.samples * 1000.0 / SAMPLING_FREQUENCY;
+    worker->audio_ms += duration;
+    worker->tracks++;
+    LOG(INFO, "%s (%d:%02d%s)", out_path, (int)duration / 60000, ((int)duration % 60000) / 1000, timed ? "": ", untimed");
+
+cleanup:
+    free_mapper(&emulator->mapper);
+    exit_ppu(&emulator->ppu);
+}
+
+static int render_worker(void* data) {
+    RenderWorker* worker = data;
+    RenderQueue* queue = worker->queue;
+    int index;
+    while((index = SDL_AtomicAdd(&queue->next, 1)) < (int)queue->len) {
+        render_track(worker, &queue->jobs[index]);
+    }
+    return 0;
+}
+
+static uint8_t has_nsf_extension(const char* file_name) {
+    const char* ext = strrchr(file_name, '.');
+    if(ext == NULL)
+        return 0;
+    char lower[6] = {0};
+    for(size_t i = 0; i < sizeof(lower) - 1 && ext[i]; i++)
+        lower[i] = (char)tolower((unsigned char)ext[i]);
+    return strcmp(lower, ".nsf") == 0 || strcmp(lower, ".nsfe") == 0;
+}
+
+static void add_file(RenderQueue* queue, const char* path) {
+    // load once up front to find out how many tracks there are
+    Mapper mapper;
+    if(load_file((char*)path, NULL, NULL, &mapper) < 0) {
+        LOG(ERROR, "Could not load %s, skipping", path);
+        return;
+    }
+    if(!mapper.is_nsf) {
+        LOG(ERROR, "%s is not an NSF/NSFe file, skipping", path);
+        free_mapper(&mapper);
+        return;
+    }
+
+    char* owned = malloc(strlen(path) + 1);
+    strcpy(owned, path);
+    queue->paths = realloc(queue->paths, (queue->path_count + 1) * sizeof(char*));
+    queue->paths[queue->path_count++] = owned;
+
+    for(uint8_t track = 1; track <= mapper.NSF->total_songs; track++) {
+        if(queue->len >= queue->cap) {
+            queue->cap = queue->cap ? queue->cap * 2 : 64;
+            queue->jobs = realloc(queue->jobs, queue->cap * sizeof(RenderJob));
+        }
+        queue->jobs[queue->len].path = owned;
+        queue->jobs[queue->len].track = track;
+        queue->len++;
+    }
+    free_mapper(&mapper);
+}
+
+static void add_path(RenderQueue* queue, const char* path) {
+    DIR* dir = opendir(path);
+    if(dir == NULL) {
+        add_file(queue, path);
+        return;
+    }
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL) {
+        if(!has_nsf_extension(entry->d_name))
+            continue;
+        size_t len = strlen(path) + strlen(entry->d_name) + 2;
+        char* file_path = malloc(len);
+        snprintf(file_path, len, "%s/%s", path, entry->d_name);
+        add_file(queue, file_path);
+        free(file_path);
+    }
+    closedir(dir);
+}
+
+int export_wav(int argc, char *argv[]) {
+    if(argc < 4) {
+        LOG(ERROR, "Usage: %s --render-wav <output dir> [-j threads] <file|dir>...", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    RenderQueue queue;
+    memset(&queue, 0, sizeof(RenderQueue));
+    queue.out_dir = argv[2];
+    int threads = SDL_GetCPUCount();
+
+    for(int i = 3; i < argc; i++) {
+        if(strcmp(argv[i], "-j") == 0) {
+            if(i + 1 < argc) {
+                threads = atoi(argv[++i]);
+            } else {
+                LOG(ERROR, "-j option requires an argument");
+                return EXIT_FAILURE;
+            }
+        } else {
+            add_path(&queue, argv[i]);
+        }
+    }
+
+    if(!queue.len) {
+        LOG(ERROR, "No NSF tracks to render");
+        return EXIT_FAILURE;
+    }
+    make_dir(queue.out_dir);
+    threads = threads < 1 ? 1 : threads > (int)queue.len ? (int)queue.len : threads;
+    LOG(INFO, "Rendering %zu tracks from %zu files on %d threads", queue.len, queue.path_count, threads);
+
+    Timer timer;
+    init_timer(&timer, 0);
+    mark_start(&timer);
+
+    RenderWorker* workers = calloc(threads, sizeof(RenderWorker));
+    for(int i = 0; i < threads; i++) {
+        workers[i].queue = &queue;
+        workers[i].thread = SDL_CreateThread(render_worker, "render_worker", &workers[i]);
+    }
+
+    size_t tracks = 0;
+    double audio_ms = 0;
+    for(int i = 0; i < threads; i++) {
+        SDL_WaitThread(workers[i].thread, NULL);
+        tracks += workers[i].tracks;
+        audio_ms += workers[i].audio_ms;
+    }
+
+    mark_end(&timer);
+    double wall_ms = get_diff_ms(&timer);
+    LOG(INFO, "Rendered %zu tracks (%.1f min of audio) in %.1f s, %.1fx realtime",
+        tracks, audio_ms / 60000, wall_ms / 1000, audio_ms / (wall_ms > 0 ? wall_ms : 1));
+
+    release_timer(&timer);
+    free(workers);
+    for(size_t i = 0; i < queue.path_count; i++)
+        free(queue.paths[i]);
+    free(queue.paths);
+    free(queue.jobs);
+    return EXIT_SUCCESS;
+}